@@ -0,0 +1,209 @@
+#include "../src/include/parser.hxx"
+#include "../src/include/binary.hxx"
+#include "../src/include/text.hxx"
+#include "../src/include/threadpool.hxx"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <unistd.h>
+
+using namespace std;
+
+// Benchmark of matrix operations, parsing and file I/O, results are written to stdout as JSON
+//
+// usage: morozan1_bench [--sizes 64,256,512] [--seconds 0.2]
+//        sizes are the dimensions of the square matrices, every measurement runs for at least
+//        the given number of seconds and at least three times
+
+namespace {
+    const size_t MIN_REPEATS = 3;
+
+    struct Result {
+        string benchmark;   ///< operation
+        string type;        ///< type of the operand as reported by whoami
+        size_t size;        ///< dimension of the operand
+        size_t repeats;     ///< number of measured runs
+        double min;         ///< fastest run in seconds
+        double median;      ///< median run in seconds
+        size_t bytes;       ///< bytes handled by one run, zero if not applicable
+        string error;       ///< message if the operation threw
+    };
+
+    // escapes a string for JSON
+    string quoted(const string& s) {
+        string result = "\"";
+        for (char c : s) {
+            if (c == '"' || c == '\\')
+                result += '\\';
+            result += c;
+        }
+        return result + "\"";
+    }
+
+    // runs setup outside and body inside of the measured time until enough time passed
+    template <typename Setup, typename Body>
+    Result measure(const string& benchmark, size_t size, double seconds, Setup setup, Body body) {
+        Result result{benchmark, "", size, 0, 0, 0, 0, ""};
+        vector<double> times;
+        double total = 0;
+        try {
+            while (times.size() < MIN_REPEATS || total < seconds) {
+                auto operand = setup();
+                auto start = chrono::steady_clock::now();
+                body(operand);
+                double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+                times.push_back(elapsed);
+                total += elapsed;
+            }
+        } catch (exception& e) {
+            result.error = e.what();
+        }
+        if (!times.empty()) {
+            sort(times.begin(), times.end());
+            result.repeats = times.size();
+            result.min = times.front();
+            result.median = times[times.size() / 2];
+        }
+        return result;
+    }
+
+    Storage random(size_t rows, size_t cols, mt19937& generator) {
+        uniform_real_distribution<double> element(-1, 1);
+        Storage data(rows, cols);
+        for (size_t i = 0; i < rows; i++)
+            for (size_t j = 0; j < cols; j++)
+                data(i, j) = element(generator);
+        return data;
+    }
+
+    // elements of a matrix of every benchmarked type, a new object is classified from them for every run
+    vector<Storage> operands(size_t n, mt19937& generator) {
+        Storage dense = random(n, n, generator), upper = Storage::zeros(n, n), diagonal = Storage::zeros(n, n),
+                identity = Storage::zeros(n, n), zero = Storage::zeros(n, n), sparse = Storage::zeros(n, n);
+        for (size_t i = 0; i < n; i++) {
+            copy(dense.row(i) + i, dense.row(i) + n, upper.row(i) + i);
+            diagonal(i, i) = dense(i, i);
+            identity(i, i) = 1;
+            // a few elements per row, well under the density of a sparse matrix
+            for (size_t j = i % 50; j < n; j += 50)
+                sparse(i, j) = dense(i, j);
+            sparse(i, i) = 1;
+        }
+        return {random(1, 1, generator), zero, dense, upper, diagonal, identity, sparse};
+    }
+
+    vector<size_t> parseSizes(const string& list) {
+        vector<size_t> sizes;
+        size_t start = 0;
+        while (start < list.size()) {
+            size_t end = list.find(',', start);
+            end = end == string::npos ? list.size() : end;
+            sizes.push_back(stoul(list.substr(start, end - start)));
+            start = end + 1;
+        }
+        return sizes;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    vector<size_t> sizes = {64, 256, 512};
+    double seconds = 0.2;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        string option = argv[i];
+        if (option == "--sizes")
+            sizes = parseSizes(argv[i + 1]);
+        else if (option == "--seconds")
+            seconds = stod(argv[i + 1]);
+    }
+    mt19937 generator(42);
+    vector<Result> results;
+    auto record = [&](Result result, const string& type) {
+        result.type = type;
+        cerr << result.benchmark << " " << type << " " << result.size << ": " << result.median << " s" << endl;
+        results.push_back(result);
+    };
+
+    for (size_t n : sizes) {
+        for (const Storage& data : operands(n, generator)) {
+            auto make = [data]() {
+                return Matrix::classify(data.clone());
+            };
+            string type = make()->whoami();
+            size_t size = data.rows();
+            shared_ptr<Matrix> exponent = make_shared<Number>(8);
+            record(measure("prod", size, seconds, make, [](shared_ptr<Matrix> m) { m->prod(m); }), type);
+            record(measure("add", size, seconds, make, [](shared_ptr<Matrix> m) { m->add(m); }), type);
+            record(measure("transpose", size, seconds, make, [](shared_ptr<Matrix> m) { m->transpose()->dense(); }), type);
+            record(measure("gem", size, seconds, make, [](shared_ptr<Matrix> m) { m->gem(); }), type);
+            record(measure("det", size, seconds, make, [](shared_ptr<Matrix> m) { m->det(); }), type);
+            record(measure("rank", size, seconds, make, [](shared_ptr<Matrix> m) { m->rank(); }), type);
+            record(measure("power", size, seconds, make, [&](shared_ptr<Matrix> m) { m->power(exponent); }), type);
+            // transform of a generic matrix holding the elements, which is what a concatenation or crop classifies
+            record(measure("transform", size, seconds, [data]() { return make_shared<Matrix>(data.clone()); },
+                           [](shared_ptr<Matrix> m) { m->transform(); }), type);
+        }
+
+        // a dense literal typed into the REPL
+        Storage data = random(n, n, generator);
+        shared_ptr<Matrix> dense = Matrix::classify(data);
+        string literal = "X = [";
+        for (size_t i = 0; i < n; i++) {
+            char number[32];
+            for (size_t j = 0; j < n; j++) {
+                snprintf(number, sizeof(number), "%.6f ", abs(data(i, j)));
+                literal += number;
+            }
+            literal += i + 1 < n ? "& " : "]\n";
+        }
+        Result parse = measure("literal", n, seconds, [&]() { return literal + "exit\n"; }, [](const string& input) {
+            stringstream is(input), os;
+            Parser(".", os, is).run();
+        });
+        parse.bytes = literal.size();
+        record(parse, dense->whoami());
+
+        // text and binary files in a temporary directory
+        char directory[] = "/tmp/morozan1_benchXXXXXX";
+        if (mkdtemp(directory) == nullptr)
+            continue;
+        string textPath = string(directory) + "/X.matix", binaryPath = string(directory) + "/X.matb";
+        Result save = measure("save_matix", n, seconds, [&]() { return dense; }, [&](shared_ptr<Matrix> m) {
+            ofstream file(textPath);
+            m->print(file);
+        });
+        record(save, dense->whoami());
+        Result load = measure("load_matix", n, seconds, [&]() { return textPath; }, [](const string& path) {
+            text::Throughput throughput;
+            text::load(path, throughput);
+        });
+        load.bytes = ifstream(textPath, ios::ate | ios::binary).tellg();
+        record(load, dense->whoami());
+        record(measure("save_matb", n, seconds, [&]() { return dense; }, [&](shared_ptr<Matrix> m) {
+            ofstream file(binaryPath, ios::binary);
+            binary::save(file, *m);
+        }), dense->whoami());
+        record(measure("load_matb", n, seconds, [&]() { return binaryPath; }, [](const string& path) {
+            binary::load(path)->dense();
+        }), dense->whoami());
+        remove(textPath.c_str());
+        remove(binaryPath.c_str());
+        rmdir(directory);
+    }
+
+    cout << "{\n  \"threads\": " << ThreadPool::instance().size() << ",\n  \"compiler\": " << quoted(__VERSION__)
+         << ",\n  \"results\": [\n";
+    cout.precision(9);
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result& r = results[i];
+        cout << "    {\"benchmark\": " << quoted(r.benchmark) << ", \"type\": " << quoted(r.type) << ", \"size\": " << r.size
+             << ", \"repeats\": " << r.repeats << ", \"min_s\": " << r.min << ", \"median_s\": " << r.median;
+        if (r.bytes > 0)
+            cout << ", \"bytes\": " << r.bytes;
+        if (!r.error.empty())
+            cout << ", \"error\": " << quoted(r.error);
+        cout << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    cout << "  ]\n}" << endl;
+    return 0;
+}
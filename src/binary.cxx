@@ -0,0 +1,193 @@
+#include "include/binary.hxx"
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Implementation of binary matrix files
+
+namespace {
+    static_assert(sizeof(binary::Header) <= Storage::ALIGNMENT, "header must fit before the aligned payload");
+    static_assert(sizeof(size_t) == sizeof(uint64_t), "indices of compressed rows are written as they are");
+
+    // closes the descriptor when the load returns or throws
+    struct Descriptor {
+        int fd;
+        ~Descriptor() {
+            if (fd >= 0)
+                close(fd);
+        }
+    };
+
+    void check(bool condition) {
+        if (!condition)
+            throw runtime_error("Damaged matrix file");
+    }
+
+    size_t aligned(size_t bytes) {
+        return (bytes + Storage::ALIGNMENT - 1) / Storage::ALIGNMENT * Storage::ALIGNMENT;
+    }
+
+    // a * b for sizes read from a file, checked against overflow
+    size_t product(size_t a, size_t b) {
+        check(b == 0 || a <= numeric_limits<size_t>::max() / 2 / b);
+        return a * b;
+    }
+
+    // writes an array and pads it to the next aligned offset
+    void section(ostream& os, const void* data, size_t size) {
+        static const char zeros[Storage::ALIGNMENT] = {};
+        os.write(static_cast<const char*>(data), size);
+        os.write(zeros, aligned(size) - size);
+    }
+
+    // file mapped privately, released with the last pointer sharing it
+    shared_ptr<char> map(int fd, size_t size) {
+        void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED)
+            throw runtime_error("Cannot map matrix file");
+        madvise(mapping, size, MADV_SEQUENTIAL);
+        return shared_ptr<char>(static_cast<char*>(mapping), [size](char* p) {
+            munmap(p, size);
+        });
+    }
+
+    // rows of compressed rows copied out of the payload, indices are checked before use
+    SparseMatrix::Csr readCsr(const char* payload, size_t size, const binary::Header& header) {
+        size_t nonzeros = header.stride;
+        size_t columnsAt = aligned(product(header.rows + 1, sizeof(size_t)));
+        size_t valuesAt = columnsAt + aligned(product(nonzeros, sizeof(size_t)));
+        check(valuesAt + product(nonzeros, sizeof(double)) <= size);
+        const size_t* offsets = reinterpret_cast<const size_t*>(payload);
+        const size_t* columns = reinterpret_cast<const size_t*>(payload + columnsAt);
+        const double* values = reinterpret_cast<const double*>(payload + valuesAt);
+        SparseMatrix::Csr csr;
+        csr.offsets.assign(offsets, offsets + header.rows + 1);
+        csr.columns.assign(columns, columns + nonzeros);
+        csr.values.assign(values, values + nonzeros);
+        check(csr.offsets.front() == 0 && csr.offsets.back() == nonzeros);
+        for (size_t i = 0; i < header.rows; i++) {
+            check(csr.offsets[i] <= csr.offsets[i + 1]);
+            for (size_t k = csr.offsets[i]; k < csr.offsets[i + 1]; k++)
+                check(csr.columns[k] < header.cols && (k == csr.offsets[i] || csr.columns[k - 1] < csr.columns[k]));
+        }
+        return csr;
+    }
+}
+
+bool binary::detect(const string& path) {
+    Descriptor file{open(path.c_str(), O_RDONLY)};
+    char magic[sizeof(MAGIC)];
+    return file.fd >= 0 && pread(file.fd, magic, sizeof(magic), 0) == sizeof(magic) && memcmp(magic, MAGIC, sizeof(MAGIC)) == 0;
+}
+
+shared_ptr<Matrix> binary::load(const string& path) {
+    Descriptor file{open(path.c_str(), O_RDONLY)};
+    struct stat info;
+    if (file.fd < 0 || fstat(file.fd, &info) != 0)
+        throw runtime_error("Cannot open matrix file");
+    Header header = {};
+    check(pread(file.fd, &header, sizeof(header), 0) == sizeof(header) && memcmp(header.magic, MAGIC, sizeof(MAGIC)) == 0);
+    if (header.version != VERSION || (header.dtype != DTYPE_FLOAT64 && header.dtype != DTYPE_FLOAT32))
+        throw runtime_error("Unsupported matrix file version");
+    if (header.rows == 0 || header.cols == 0)
+        return make_shared<Matrix>();
+
+    size_t rows = header.rows, cols = header.cols, size = info.st_size;
+    check(header.alignment == Storage::ALIGNMENT && header.offset % Storage::ALIGNMENT == 0 && header.offset <= size);
+    check(header.structure <= static_cast<uint32_t>(Structure::DIAGONAL) && header.layout <= static_cast<uint32_t>(Layout::SPARSE));
+    Structure structure = static_cast<Structure>(header.structure);
+    Layout layout = static_cast<Layout>(header.layout);
+    check(layout == Layout::DENSE || layout == Layout::ZERO || layout == Layout::SPARSE || rows == cols);
+    check(structure == Structure::GENERAL || rows == cols);
+
+    // layouts without elements need no mapping
+    if (layout == Layout::ZERO)
+        return make_shared<ZeroMatrix>(rows, cols);
+    if (layout == Layout::IDENTITY)
+        return make_shared<IdentityMatrix>(rows);
+
+    shared_ptr<char> mapping = map(file.fd, size);
+    if (header.dtype == DTYPE_FLOAT32) {
+        check(layout == Layout::DENSE && header.stride == FloatMatrix::paddedStride(cols));
+        check(product(rows, product(header.stride, sizeof(float))) <= size - header.offset);
+        return make_shared<FloatMatrix>(shared_ptr<float>(mapping, reinterpret_cast<float*>(mapping.get() + header.offset)), rows, cols);
+    }
+    if (layout == Layout::SPARSE)
+        return make_shared<SparseMatrix>(rows, cols, readCsr(mapping.get() + header.offset, size - header.offset, header));
+
+    // elements stay in the mapping, the buffer shares its ownership
+    size_t storageRows = layout == Layout::DENSE ? rows : 1;
+    size_t storageCols = layout == Layout::DENSE ? cols : layout == Layout::DIAGONAL ? rows : product(rows, rows + 1) / 2;
+    Storage data(shared_ptr<double>(mapping, reinterpret_cast<double*>(mapping.get() + header.offset)), storageRows, storageCols);
+    check(data.stride() == header.stride && product(storageRows, product(data.stride(), sizeof(double))) <= size - header.offset);
+    switch (layout) {
+        case Layout::DIAGONAL:
+            return make_shared<DiagonalMatrix>(rows, data);
+        case Layout::UPPER:
+            return make_shared<TriangularMatrix>(rows, data);
+        default:
+            break;
+    }
+    if (rows == 1 && cols == 1)
+        return make_shared<Number>(data(0, 0));
+    if (rows == cols)
+        return make_shared<SquareMatrix>(data);
+    return make_shared<Matrix>(data);
+}
+
+void binary::save(ostream& os, const Matrix& matrix) {
+    Header header = {};
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.structure = static_cast<uint32_t>(matrix.structure());
+    header.dtype = DTYPE_FLOAT64;
+    header.alignment = Storage::ALIGNMENT;
+    header.rows = matrix.rows();
+    header.cols = matrix.cols();
+    header.offset = aligned(sizeof(header));
+    header.layout = static_cast<uint32_t>(matrix.layout());
+
+    if (matrix.isFloat()) {
+        const FloatMatrix& single = static_cast<const FloatMatrix&>(matrix);
+        header.dtype = DTYPE_FLOAT32;
+        header.stride = single.stride();
+        section(os, &header, sizeof(header));
+        os.write(reinterpret_cast<const char*>(single.values()), header.rows * header.stride * sizeof(float));
+        if (!os)
+            throw runtime_error("Cannot write matrix file");
+        return;
+    }
+    Storage data;
+    switch (matrix.layout()) {
+        case Layout::DENSE:
+            data = matrix.dense();
+            break;
+        case Layout::DIAGONAL:
+        case Layout::UPPER:
+            data = matrix.storage();
+            break;
+        case Layout::SPARSE:
+            header.stride = static_cast<const SparseMatrix&>(matrix).nonzeros();
+            break;
+        default:
+            break;
+    }
+    if (!data.empty())
+        header.stride = data.stride();
+    section(os, &header, sizeof(header));
+    // padding of the rows is written as well, so the payload maps straight into Storage
+    if (!data.empty())
+        os.write(reinterpret_cast<const char*>(data.data()), data.rows() * data.stride() * sizeof(double));
+    if (matrix.layout() == Layout::SPARSE) {
+        const SparseMatrix::Csr& csr = static_cast<const SparseMatrix&>(matrix).csr();
+        section(os, csr.offsets.data(), csr.offsets.size() * sizeof(size_t));
+        section(os, csr.columns.data(), csr.columns.size() * sizeof(size_t));
+        section(os, csr.values.data(), csr.values.size() * sizeof(double));
+    }
+    if (!os)
+        throw runtime_error("Cannot write matrix file");
+}
@@ -0,0 +1,133 @@
+#include "include/cache.hxx"
+#include <cstring>
+
+using namespace std;
+
+// Implementation of ResultCache
+
+bool ResultCache::Operand::operator==(const Operand& other) const {
+    // numbers compare by bits, so 0 and -0 are different keys
+    return matrix == other.matrix && memcmp(&number, &other.number, sizeof(number)) == 0;
+}
+
+bool ResultCache::Key::operator==(const Key& other) const {
+    return op == other.op && lhs == other.lhs && rhs == other.rhs;
+}
+
+size_t ResultCache::KeyHash::operator()(const Key& key) const {
+    size_t h = hash<string>()(key.op);
+    for (const Operand* o : {&key.lhs, &key.rhs}) {
+        h = h * 31 + hash<const Matrix*>()(o->matrix);
+        h = h * 31 + hash<double>()(o->number);
+    }
+    return h;
+}
+
+ResultCache::ResultCache(size_t budget) : m_lock(), m_budget(budget), m_stats(), m_entries(), m_index() {}
+
+shared_ptr<Matrix> ResultCache::get(const string& op, const shared_ptr<Matrix>& lhs, const shared_ptr<Matrix>& rhs,
+                                    const function<shared_ptr<Matrix>()>& compute) {
+    Key key{op, operand(lhs), operand(rhs)};
+    {
+        unique_lock<mutex> guard(m_lock);
+        if (m_budget == 0) {
+            guard.unlock();
+            return compute();
+        }
+        auto found = m_index.find(key);
+        if (found != m_index.end()) {
+            if (!stale(*found->second)) {
+                m_stats.hits++;
+                m_entries.splice(m_entries.begin(), m_entries, found->second);
+                return found->second->result;
+            }
+            erase(found->second);
+        }
+        m_stats.misses++;
+    }
+    shared_ptr<Matrix> result = compute();
+    size_t bytes = footprint(*result);
+    lock_guard<mutex> guard(m_lock);
+    if (bytes > m_budget)
+        return result;
+    // another thread may have computed the same result meanwhile
+    auto found = m_index.find(key);
+    if (found != m_index.end())
+        erase(found->second);
+    Entry entry{key, key.lhs.matrix != nullptr ? lhs : nullptr, key.rhs.matrix != nullptr ? rhs : nullptr, result, bytes};
+    m_entries.push_front(move(entry));
+    m_index[key] = m_entries.begin();
+    m_stats.entries++;
+    m_stats.bytes += bytes;
+    shrink();
+    return result;
+}
+
+void ResultCache::invalidate(const shared_ptr<Matrix>& operand) {
+    lock_guard<mutex> guard(m_lock);
+    for (auto it = m_entries.begin(); it != m_entries.end();) {
+        auto next = std::next(it);
+        if (it->key.lhs.matrix == operand.get() || it->key.rhs.matrix == operand.get() || stale(*it))
+            erase(it);
+        it = next;
+    }
+}
+
+void ResultCache::setBudget(size_t budget) {
+    lock_guard<mutex> guard(m_lock);
+    m_budget = budget;
+    shrink();
+}
+
+size_t ResultCache::budget() const {
+    lock_guard<mutex> guard(m_lock);
+    return m_budget;
+}
+
+ResultCache::Stats ResultCache::stats() const {
+    lock_guard<mutex> guard(m_lock);
+    return m_stats;
+}
+
+ResultCache::Operand ResultCache::operand(const shared_ptr<Matrix>& m) {
+    Operand result;
+    if (m == nullptr)
+        return result;
+    if (m->isNumber())
+        result.number = m->number();
+    else
+        result.matrix = m.get();
+    return result;
+}
+
+size_t ResultCache::footprint(const Matrix& m) {
+    // views and blocks keep the matrices they are made of alive
+    if (m.isView() || m.isBlock())
+        return m.rows() * m.cols() * sizeof(double);
+    if (m.isFloat())
+        return m.rows() * static_cast<const FloatMatrix&>(m).stride() * sizeof(float);
+    if (m.isSparse()) {
+        const SparseMatrix& sparse = static_cast<const SparseMatrix&>(m);
+        return sparse.nonzeros() * (sizeof(double) + sizeof(size_t)) + (m.rows() + 1) * sizeof(size_t);
+    }
+    return m.storage().rows() * m.storage().stride() * sizeof(double);
+}
+
+bool ResultCache::stale(const Entry& entry) {
+    // the address of a freed operand may be reused by another matrix
+    return (entry.key.lhs.matrix != nullptr && entry.lhs.expired()) || (entry.key.rhs.matrix != nullptr && entry.rhs.expired());
+}
+
+void ResultCache::erase(list<Entry>::iterator entry) {
+    m_stats.entries--;
+    m_stats.bytes -= entry->bytes;
+    m_index.erase(entry->key);
+    m_entries.erase(entry);
+}
+
+void ResultCache::shrink() {
+    while (m_stats.bytes > m_budget && !m_entries.empty()) {
+        erase(prev(m_entries.end()));
+        m_stats.evictions++;
+    }
+}
@@ -0,0 +1,162 @@
+#include "include/expression.hxx"
+#include "include/profile.hxx"
+#include "include/threadpool.hxx"
+#include <algorithm>
+
+using namespace std;
+
+// Implementation of Expression
+
+namespace {
+    const size_t PARALLEL_ELEMENTS = 1 << 15; ///< elements per task of the fused pass
+
+    // operand of an element-wise node which is not evaluated right away
+    bool fusable(const shared_ptr<Expression>& e) {
+        return !e->isNumber() && e->rows() > 0 && e->cols() > 0;
+    }
+
+    bool sameSize(const shared_ptr<Expression>& lhs, const shared_ptr<Expression>& rhs) {
+        return lhs->rows() == rhs->rows() && lhs->cols() == rhs->cols();
+    }
+}
+
+Expression::Expression(Kind kind, shared_ptr<Expression> lhs, shared_ptr<Expression> rhs, double factor)
+    : m_kind(kind), m_value(), m_lhs(lhs), m_rhs(rhs), m_factor(factor), m_rows(lhs->rows()), m_cols(lhs->cols()) {}
+
+Expression::Expression(shared_ptr<Matrix> matrix)
+    : m_kind(VALUE), m_value(matrix), m_lhs(), m_rhs(), m_factor(1), m_rows(matrix->rows()), m_cols(matrix->cols()) {}
+
+shared_ptr<Expression> Expression::value(shared_ptr<Matrix> matrix) {
+    return shared_ptr<Expression>(new Expression(matrix));
+}
+
+shared_ptr<Expression> Expression::neg(shared_ptr<Expression> operand) {
+    if (!fusable(operand)) {
+        static profile::Site site("neg");
+        profile::Scope scope(&site);
+        return value(operand->evaluate()->neg());
+    }
+    return shared_ptr<Expression>(new Expression(NEG, operand, nullptr));
+}
+
+shared_ptr<Expression> Expression::add(shared_ptr<Expression> lhs, shared_ptr<Expression> rhs) {
+    // anything else is left to the matrices, they know which combinations are errors
+    if (!fusable(lhs) || !fusable(rhs) || !sameSize(lhs, rhs)) {
+        static profile::Site site("add");
+        profile::Scope scope(&site);
+        return value(lhs->evaluate()->add(rhs->evaluate()));
+    }
+    return shared_ptr<Expression>(new Expression(ADD, lhs, rhs));
+}
+
+shared_ptr<Expression> Expression::sub(shared_ptr<Expression> lhs, shared_ptr<Expression> rhs) {
+    if (!fusable(lhs) || !fusable(rhs) || !sameSize(lhs, rhs)) {
+        static profile::Site site("sub");
+        profile::Scope scope(&site);
+        return value(lhs->evaluate()->sub(rhs->evaluate()));
+    }
+    return shared_ptr<Expression>(new Expression(SUB, lhs, rhs));
+}
+
+shared_ptr<Expression> Expression::prod(shared_ptr<Expression> lhs, shared_ptr<Expression> rhs) {
+    if (!fusable(lhs) || !rhs->isNumber()) {
+        static profile::Site site("scale");
+        profile::Scope scope(&site);
+        return value(lhs->evaluate()->prod(rhs->evaluate()));
+    }
+    return shared_ptr<Expression>(new Expression(SCALE, lhs, nullptr, rhs->evaluate()->number()));
+}
+
+shared_ptr<Expression> Expression::div(shared_ptr<Expression> lhs, shared_ptr<Expression> rhs) {
+    if (!fusable(lhs) || !rhs->isNumber() || rhs->evaluate()->number() == 0) {
+        static profile::Site site("div");
+        profile::Scope scope(&site);
+        return value(lhs->evaluate()->div(rhs->evaluate()));
+    }
+    return shared_ptr<Expression>(new Expression(SCALE, lhs, nullptr, 1 / rhs->evaluate()->number()));
+}
+
+shared_ptr<Matrix> Expression::evaluate() {
+    if (m_value != nullptr)
+        return m_value;
+    vector<pair<double, shared_ptr<Matrix>>> terms;
+    collect(1, terms);
+    static profile::Site site("fused");
+    profile::Scope scope(&site, 2.0 * terms.size() * m_rows * m_cols);
+    Structure known = Structure::DIAGONAL;
+    bool sparse = true, single = true;
+    for (size_t t = 0; t < terms.size(); t++) {
+        known = meet(known, terms[t].second->structure());
+        sparse = sparse && terms[t].second->isSparse();
+        single = single && terms[t].second->isFloat();
+    }
+
+    // diagonal and sparse leaves are combined by their own operations, the zeros are never touched
+    if (known == Structure::DIAGONAL || sparse) {
+        m_value = terms[0].second->prod(make_shared<Number>(terms[0].first));
+        for (size_t t = 1; t < terms.size(); t++)
+            m_value = m_value->add(terms[t].second->prod(make_shared<Number>(terms[t].first)));
+        m_lhs = m_rhs = nullptr;
+        return m_value;
+    }
+
+    // result = sum of coefficient * leaf, every element is written once
+    Storage result(m_rows, m_cols);
+    ThreadPool::instance().parallelFor(0, m_rows, max<size_t>(1, PARALLEL_ELEMENTS / m_cols), [&](size_t lo, size_t hi) {
+        vector<double> buffer(m_cols);
+        for (size_t i = lo; i < hi; i++) {
+            double* out = result.row(i);
+            for (size_t t = 0; t < terms.size(); t++) {
+                double c = terms[t].first;
+                const double* row = terms[t].second->readRow(i, buffer.data());
+                if (t == 0)
+                    for (size_t j = 0; j < m_cols; j++)
+                        out[j] = c * row[j];
+                else
+                    for (size_t j = 0; j < m_cols; j++)
+                        out[j] += c * row[j];
+            }
+        }
+    });
+    // sums of float matrices only are rounded to float once, at the end
+    m_value = single ? FloatMatrix::narrow(make_shared<Matrix>(result)) : Matrix::classify(result, known);
+    m_lhs = m_rhs = nullptr;
+    return m_value;
+}
+
+size_t Expression::rows() const {
+    return m_rows;
+}
+
+size_t Expression::cols() const {
+    return m_cols;
+}
+
+bool Expression::isNumber() const {
+    return m_value != nullptr && m_value->isNumber();
+}
+
+void Expression::collect(double coefficient, vector<pair<double, shared_ptr<Matrix>>>& terms) {
+    if (m_value != nullptr) {
+        terms.push_back(make_pair(coefficient, m_value));
+        return;
+    }
+    switch (m_kind) {
+        case ADD:
+            m_lhs->collect(coefficient, terms);
+            m_rhs->collect(coefficient, terms);
+            break;
+        case SUB:
+            m_lhs->collect(coefficient, terms);
+            m_rhs->collect(-coefficient, terms);
+            break;
+        case NEG:
+            m_lhs->collect(-coefficient, terms);
+            break;
+        case SCALE:
+            m_lhs->collect(coefficient * m_factor, terms);
+            break;
+        case VALUE:
+            break;
+    }
+}
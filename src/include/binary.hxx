@@ -0,0 +1,69 @@
+/**
+ * @file binary.hxx
+ * @author morozan1
+ * @brief Binary matrix file format
+ */
+#pragma once
+#include "matrix.hxx"
+#include <cstdint>
+#include <ostream>
+/**
+ * @brief Versioned binary matrix files, loaded by mapping them into memory
+ *
+ * A file is a header padded to Storage::ALIGNMENT bytes followed by the payload, which holds
+ * only the elements the type of the matrix keeps (see Layout): nothing for zero and identity
+ * matrices, the diagonal, the packed upper triangle, compressed rows or all rows of the matrix.
+ * Stored elements are laid out exactly as in Storage, so a loaded dense, triangular or diagonal
+ * matrix uses the mapping of the file as its buffer and nothing is copied, only compressed rows
+ * are copied into SparseMatrix. The type is rebuilt from the layout without looking at the elements.
+ * The mapping is private, the file is never written through it. Float matrices are written with
+ * the DENSE layout and float elements, they are mapped in the same way.
+ */
+namespace binary {
+    const char MAGIC[8] = {'M', 'T', 'R', 'X', 'B', 'I', 'N', '\0'}; ///< first bytes of every binary file
+    const uint32_t VERSION = 2;         ///< version written by save(), the only one load() accepts
+    const uint32_t DTYPE_FLOAT64 = 1;   ///< elements are IEEE 754 doubles
+    const uint32_t DTYPE_FLOAT32 = 2;   ///< elements are IEEE 754 floats, DENSE layout only
+
+    /**
+     * SPARSE payload is three arrays, each starting on an aligned offset: rows + 1 row offsets,
+     * column indices and elements, indices are 64-bit unsigned integers
+     * @brief header at the start of a binary file, all fields are in host byte order
+     */
+    struct Header {
+        char magic[8];      ///< MAGIC
+        uint32_t version;   ///< format version
+        uint32_t structure; ///< Structure of the matrix
+        uint32_t dtype;     ///< element type of the payload
+        uint32_t alignment; ///< alignment of the payload and of padded rows in bytes
+        uint64_t rows;      ///< number of rows
+        uint64_t cols;      ///< number of columns
+        uint64_t stride;    ///< row stride of the stored elements, number of stored elements for SPARSE
+        uint64_t offset;    ///< start of the payload in bytes from the start of the file
+        uint32_t layout;    ///< Layout of the payload
+        uint32_t reserved;  ///< zero
+    };
+
+    /**
+     * @brief check the magic bytes of a file
+     * @param path: path to the file
+     * @return bool: true if the file exists and is a binary matrix file
+     */
+    bool detect(const std::string& path);
+
+    /**
+     * @brief map a binary file and build the matrix of the saved type on top of the mapping
+     * @param path: path to the file
+     * @throw std::runtime_error: if the file cannot be mapped, is damaged or has an unsupported version
+     * @return std::shared_ptr<Matrix>: loaded matrix
+     */
+    std::shared_ptr<Matrix> load(const std::string& path);
+
+    /**
+     * @brief write header and the elements kept by the matrix
+     * @param os: stream opened in binary mode
+     * @param matrix: matrix to write
+     * @throw std::runtime_error: if writing fails
+     */
+    void save(std::ostream& os, const Matrix& matrix);
+}
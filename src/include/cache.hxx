@@ -0,0 +1,116 @@
+/**
+ * @file cache.hxx
+ * @author morozan1
+ * @brief Cache of results of expensive operations
+ */
+#pragma once
+#include "matrix.hxx"
+#include <functional>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+/**
+ * @brief Results of operations on matrices, kept while their operands are alive
+ *
+ * Matrices are immutable, so an operation applied to the same operands gives the same result.
+ * An entry is keyed by the operation and the identity of its operands, numbers are keyed by value.
+ * Operands are referenced weakly, an entry of a freed operand is never hit and is dropped when found.
+ * Results are kept within a budget of bytes, the least recently used ones are evicted first.
+ * The cache may be used from several threads, results are computed outside of its lock.
+ */
+class ResultCache {
+public:
+    static const size_t DEFAULT_BUDGET = 256000000; ///< budget in bytes of a new cache, 256 MB
+
+    /**
+     * @brief counters of the cache
+     */
+    struct Stats {
+        size_t hits = 0;      ///< lookups which found a result
+        size_t misses = 0;    ///< lookups which computed the result
+        size_t evictions = 0; ///< results dropped to stay within the budget
+        size_t entries = 0;   ///< results kept now
+        size_t bytes = 0;     ///< estimated size of the results kept now
+    };
+
+    /**
+     * @brief constructor
+     * @param budget: most bytes of results kept at once, zero disables the cache
+     */
+    ResultCache(size_t budget = DEFAULT_BUDGET);
+
+    /**
+     * @brief result of an operation, computed only if it is not cached
+     * @param op: name of the operation
+     * @param lhs: first operand
+     * @param rhs: second operand, nullptr for unary operations
+     * @param compute: computes the result, exceptions are passed on and nothing is cached
+     * @return std::shared_ptr<Matrix>: cached or computed result
+     */
+    std::shared_ptr<Matrix> get(const std::string& op, const std::shared_ptr<Matrix>& lhs, const std::shared_ptr<Matrix>& rhs,
+                                const std::function<std::shared_ptr<Matrix>()>& compute);
+
+    /**
+     * Entries of freed operands are dropped as well
+     * @brief drop all results computed from a matrix
+     * @param operand: matrix which is no longer stored under its name
+     */
+    void invalidate(const std::shared_ptr<Matrix>& operand);
+
+    /**
+     * @brief change the budget, results over it are evicted
+     * @param budget: most bytes of results kept at once, zero disables the cache
+     */
+    void setBudget(size_t budget);
+    size_t budget() const; ///< most bytes of results kept at once
+
+    Stats stats() const; ///< counters of the cache
+
+private:
+    /**
+     * @brief operand of a key, a matrix by identity or a number by value
+     */
+    struct Operand {
+        const Matrix* matrix = nullptr; ///< identity, nullptr for numbers and missing operands
+        double number = 0;              ///< value of a number
+
+        bool operator==(const Operand& other) const;
+    };
+
+    /**
+     * @brief operation and its operands
+     */
+    struct Key {
+        std::string op;
+        Operand lhs, rhs;
+
+        bool operator==(const Key& other) const;
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key& key) const;
+    };
+
+    /**
+     * @brief cached result
+     */
+    struct Entry {
+        Key key;
+        std::weak_ptr<Matrix> lhs, rhs;  ///< operands, the entry is stale once one of them is freed
+        std::shared_ptr<Matrix> result;
+        size_t bytes;                    ///< estimated size of the result
+    };
+
+    mutable std::mutex m_lock; ///< guards all members below
+    size_t m_budget;
+    Stats m_stats;
+    std::list<Entry> m_entries; ///< most recently used first
+    std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> m_index;
+
+    static Operand operand(const std::shared_ptr<Matrix>& m); ///< key of an operand
+    static size_t footprint(const Matrix& m); ///< estimated bytes held by a matrix
+    static bool stale(const Entry& entry); ///< true if an operand of the entry was freed
+
+    void erase(std::list<Entry>::iterator entry); ///< drop an entry
+    void shrink(); ///< evict least recently used entries over the budget
+};
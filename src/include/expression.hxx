@@ -0,0 +1,88 @@
+/**
+ * @file expression.hxx
+ * @author morozan1
+ * @brief Expression tree built by the Parser
+ */
+#pragma once
+#include "matrix.hxx"
+/**
+ * @brief Node of an expression tree
+ *
+ * Element-wise operations (addition, subtraction, negation, multiplication and division by
+ * a scalar) on matrices of the same size are not evaluated when the node is built.
+ * A chain of them is a linear combination of its leaves, evaluate() computes it in one pass
+ * into a single result buffer. Every other operation is evaluated immediately and becomes a leaf.
+ */
+class Expression {
+public:
+    /**
+     * @brief leaf holding an evaluated matrix
+     * @param matrix: value of the leaf
+     * @return std::shared_ptr<Expression>: pointer to the new node
+     */
+    static std::shared_ptr<Expression> value(std::shared_ptr<Matrix> matrix);
+    /**
+     * @brief negation
+     * @param operand: negated expression
+     * @return std::shared_ptr<Expression>: pointer to the new node
+     */
+    static std::shared_ptr<Expression> neg(std::shared_ptr<Expression> operand);
+    /**
+     * @brief addition
+     * @throw std::runtime_error: if operands have different dimensions
+     * @return std::shared_ptr<Expression>: pointer to the new node
+     */
+    static std::shared_ptr<Expression> add(std::shared_ptr<Expression> lhs, std::shared_ptr<Expression> rhs);
+    /**
+     * @brief subtraction
+     * @throw std::runtime_error: if operands have different dimensions
+     * @return std::shared_ptr<Expression>: pointer to the new node
+     */
+    static std::shared_ptr<Expression> sub(std::shared_ptr<Expression> lhs, std::shared_ptr<Expression> rhs);
+    /**
+     * Matrix times scalar is element-wise, any other product is evaluated immediately
+     * @brief multiplication
+     * @throw std::runtime_error: if operands cannot be multiplied
+     * @return std::shared_ptr<Expression>: pointer to the new node
+     */
+    static std::shared_ptr<Expression> prod(std::shared_ptr<Expression> lhs, std::shared_ptr<Expression> rhs);
+    /**
+     * @brief division by scalar
+     * @throw std::runtime_error: if rhs is zero or is not a scalar
+     * @return std::shared_ptr<Expression>: pointer to the new node
+     */
+    static std::shared_ptr<Expression> div(std::shared_ptr<Expression> lhs, std::shared_ptr<Expression> rhs);
+
+    /**
+     * Result is kept, evaluating the node again is free
+     * @brief value of the expression
+     * @return std::shared_ptr<Matrix>: pointer to the resulting matrix
+     */
+    std::shared_ptr<Matrix> evaluate();
+
+    size_t rows() const;    ///< number of rows of the result
+    size_t cols() const;    ///< number of columns of the result
+    bool isNumber() const;  ///< true if the result is a single number
+
+private:
+    /**
+     * @brief kind of node
+     */
+    enum Kind { VALUE, ADD, SUB, NEG, SCALE };
+
+    Kind m_kind; ///< kind of node
+    std::shared_ptr<Matrix> m_value; ///< value of a leaf or of an evaluated node
+    std::shared_ptr<Expression> m_lhs, m_rhs; ///< operands, only m_lhs is used by NEG and SCALE
+    double m_factor; ///< scalar of SCALE
+    size_t m_rows, m_cols; ///< dimensions of the result
+
+    Expression(Kind kind, std::shared_ptr<Expression> lhs, std::shared_ptr<Expression> rhs, double factor = 1);
+    Expression(std::shared_ptr<Matrix> matrix);
+
+    /**
+     * @brief flatten the tree into coefficient and leaf pairs
+     * @param coefficient: scale applied to the whole subtree
+     * @param terms: output list of terms
+     */
+    void collect(double coefficient, std::vector<std::pair<double, std::shared_ptr<Matrix>>>& terms);
+};
@@ -0,0 +1,64 @@
+/**
+ * @file kernels.hxx
+ * @author morozan1
+ * @brief Dense numeric kernels working on raw row-major buffers
+ */
+#pragma once
+#include <cstddef>
+#include <string>
+
+namespace kernels {
+    /**
+     * Computes C = alpha * A * B + beta * C
+     * A is m x k, B is k x n, C is m x n. Element (i, j) of A is a[i * rsa + j * csa],
+     * the same holds for B, C is row-major with row stride ldc.
+     * Operands are packed into cache sized panels and multiplied by a register blocked
+     * micro-kernel, AVX-512 or AVX2 is picked at runtime with a scalar fallback.
+     * A and B may each be float or double, float elements are widened to double when they are
+     * packed, so every product is accumulated in double.
+     * @brief general matrix multiplication
+     * @tparam TA: element type of A, float or double
+     * @tparam TB: element type of B, float or double
+     * @param m: number of rows of A and C
+     * @param n: number of columns of B and C
+     * @param k: number of columns of A and rows of B
+     * @param alpha: scale of the product
+     * @param a: pointer to A
+     * @param rsa: row stride of A
+     * @param csa: column stride of A
+     * @param b: pointer to B
+     * @param rsb: row stride of B
+     * @param csb: column stride of B
+     * @param beta: scale of the previous content of C, C is not read when beta is 0
+     * @param c: pointer to C
+     * @param ldc: row stride of C
+     */
+    template <typename TA, typename TB>
+    void gemm(size_t m, size_t n, size_t k, double alpha,
+              const TA* a, size_t rsa, size_t csa,
+              const TB* b, size_t rsb, size_t csb,
+              double beta, double* c, size_t ldc);
+
+    /**
+     * Computes C = A * B for upper triangular n x n matrices A and B, all row-major.
+     * Only blocks on and above the block diagonal are multiplied, which is about a sixth
+     * of the work of gemm. Blocks of C below the block diagonal are not written.
+     * @brief product of upper triangular matrices
+     * @param n: number of rows and columns
+     * @param a: pointer to A, elements below the diagonal must be zero
+     * @param lda: row stride of A
+     * @param b: pointer to B, elements below the diagonal must be zero
+     * @param ldb: row stride of B
+     * @param c: pointer to C
+     * @param ldc: row stride of C
+     */
+    void upperGemm(size_t n, const double* a, size_t lda, const double* b, size_t ldb, double* c, size_t ldc);
+
+    /**
+     * Name of the micro-kernel used by gemm: "avx512", "avx2" or "scalar"
+     * Can be forced by environment variable MTRX_GEMM, unsupported choices fall back to detection
+     * @brief selected gemm micro-kernel
+     * @return std::string: kernel name
+     */
+    std::string gemmKernel();
+}
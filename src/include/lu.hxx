@@ -0,0 +1,92 @@
+/**
+ * @file lu.hxx
+ * @author morozan1
+ * @brief LU factorization with partial pivoting
+ */
+#pragma once
+#include "matrix.hxx"
+/**
+ * @brief Factorization P * A = L * U of an m x n matrix
+ *
+ * Rows are pivoted by the largest element of the column. A column whose remaining elements
+ * are zero is skipped, so U is a row echelon form. L has unit diagonal, its multipliers are
+ * stored below the pivots in the same buffer as U.
+ *
+ * Elimination is blocked: a narrow panel of columns is factorized first, then the rest of
+ * its pivot rows is solved and the trailing matrix is updated by a single gemm,
+ * so most of the work runs in the parallel gemm kernel.
+ *
+ * A rank revealing factorization also skips columns whose remaining elements are negligible
+ * (below n^2 * epsilon * largest element of A) and sets them to zero, so the number of pivots
+ * is the rank of A. It eliminates column by column, so the columns skipped do not depend
+ * on the width of the panels.
+ */
+class LU {
+public:
+    /**
+     * @brief factorize a matrix
+     * @param data: elements of the matrix, they are copied
+     * @param revealRank: treat negligible pivots as zero
+     */
+    LU(const Storage& data, bool revealRank = false);
+
+    /**
+     * Every one of up to n eliminations may leave n * epsilon * largest of rounding in an element
+     * @brief largest pivot treated as zero by a rank revealing factorization
+     * @param largest: largest magnitude of an element of the matrix
+     * @param size: larger of the numbers of rows and columns
+     * @return double: the tolerance
+     */
+    static double tolerance(double largest, size_t size);
+
+    size_t rank() const; ///< number of pivots
+    /**
+     * Pivots are taken as they are, negligible ones included, so det of a matrix whose rank()
+     * in the rank revealing factorization is deficient may be a tiny nonzero rounding residue.
+     * It is exactly zero only when a column has no nonzero pivot at all.
+     * @brief determinant, product of the pivots, the matrix must be square
+     * @return double: the determinant
+     */
+    double det() const;
+
+    /**
+     * A factorization without negligible pivots is the same as the rank revealing one
+     * @brief whether rank and echelon form of this factorization are those of the rank revealing one
+     * @return bool: true if no pivot is negligible
+     */
+    bool revealsRank() const;
+
+    /**
+     * @brief row echelon form of the matrix
+     * @return Storage: U with zeros below the pivots
+     */
+    Storage echelon() const;
+
+    /**
+     * @brief solve A * X = B
+     * @param b: right hand side with as many rows as A
+     * @throw std::runtime_error: if A is not square or is singular
+     * @return Storage: X
+     */
+    Storage solve(const Storage& b) const;
+
+private:
+    Storage m_lu; ///< U on and above the pivots, multipliers of L below them
+    std::vector<size_t> m_rows;   ///< original index of every row of P * A
+    std::vector<size_t> m_pivots; ///< column of the pivot of every nonzero row of U
+    double m_sign; ///< determinant of P
+    double m_tolerance; ///< largest pivot which is negligible
+    double m_smallest;  ///< smallest magnitude of a pivot
+
+    /**
+     * Pivots are searched and rows swapped across the whole matrix,
+     * elimination only updates columns of the panel
+     * @brief factorize columns [c, c + width) from row r
+     * @param r: first row without a pivot
+     * @param c: first column of the panel
+     * @param width: number of columns of the panel
+     * @param tolerance: largest element treated as zero
+     * @return size_t: first row without a pivot after the panel
+     */
+    size_t factorPanel(size_t r, size_t c, size_t width, double tolerance);
+};
@@ -3,6 +3,7 @@
  * @author morozan1
  * @brief Matrix class and its derived classes
  */
+#pragma once
 #include <vector>
 #include <memory>
 #include <cmath>
@@ -10,6 +11,127 @@
 #include <stdexcept>
 #include <string>
 #include <sstream>
+#include <cstddef>
+/**
+ * @brief Contiguous row-major buffer for matrix elements
+ *
+ * All rows live in one 64-byte aligned allocation, row i starts at data() + i * stride().
+ * Rows at least one cache line wide are padded so that every row starts on a cache line.
+ * Copies share the buffer: matrices are immutable, so a buffer is only written
+ * while the matrix owning it is being constructed.
+ */
+class Storage {
+public:
+    static constexpr size_t ALIGNMENT = 64; ///< alignment of the buffer in bytes
+    static constexpr size_t LANES = ALIGNMENT / sizeof(double); ///< doubles per cache line
+
+    /**
+     * While a Pool exists, released buffers are kept and handed out again to allocations of the
+     * same size instead of going back to the system. Kept buffers are freed when the last Pool
+     * is destroyed, buffers still in use, like results stored in variables, stay with their owners
+     * and are never larger than they need to be. Pools may be alive in several threads at once.
+     * @brief reuse of buffers of temporary results, one Pool lives as long as a statement
+     */
+    class Pool {
+    public:
+        Pool();
+        ~Pool();
+        Pool(const Pool&) = delete;
+        Pool& operator=(const Pool&) = delete;
+    };
+
+    /**
+     * Constructs an empty Storage without allocation
+     * @brief default constructor
+     */
+    Storage();
+    /**
+     * Allocates storage whose elements are left unset, only the padding of the rows is zero.
+     * Buffers come from the Pool when they can, the caller writes every element.
+     * @brief constructor
+     * @param rows: number of rows
+     * @param cols: number of columns
+     */
+    Storage(size_t rows, size_t cols);
+    /**
+     * @brief zero filled storage, for results which are accumulated or written sparsely
+     * @param rows: number of rows
+     * @param cols: number of columns
+     * @return Storage: the storage
+     */
+    static Storage zeros(size_t rows, size_t cols);
+    /**
+     * Copies rows of a vector of vectors into contiguous storage
+     * @brief constructor
+     * @param data: vector of vectors of doubles
+     * @throw std::runtime_error: if rows have different sizes
+     */
+    Storage(const std::vector<std::vector<double>>& data);
+    /**
+     * Wraps a buffer allocated elsewhere, e.g. a mapped file, it is released by the deleter of the pointer
+     * @brief constructor
+     * @param buffer: ALIGNMENT aligned elements laid out as in Storage(rows, cols)
+     * @param rows: number of rows
+     * @param cols: number of columns
+     */
+    Storage(std::shared_ptr<double> buffer, size_t rows, size_t cols);
+
+    size_t rows() const;   ///< number of rows
+    size_t cols() const;   ///< number of columns
+    size_t stride() const; ///< distance between starts of two consecutive rows in elements
+    bool empty() const;    ///< true if there is no element
+
+    double* data();             ///< pointer to the first element
+    const double* data() const; ///< pointer to the first element
+    double* row(size_t i);             ///< pointer to the first element of row i
+    const double* row(size_t i) const; ///< pointer to the first element of row i
+
+    double& operator()(size_t row, size_t col);       ///< unchecked element access
+    double  operator()(size_t row, size_t col) const; ///< unchecked element access
+
+    /**
+     * @brief deep copy of the storage
+     * @return Storage: storage with its own buffer
+     */
+    Storage clone() const;
+
+    long owners() const; ///< number of storages sharing the buffer
+
+private:
+    std::shared_ptr<double> m_buffer; ///< shared aligned buffer
+    size_t m_rows;   ///< number of rows
+    size_t m_cols;   ///< number of columns
+    size_t m_stride; ///< row stride in elements
+};
+/**
+ * @brief Structure of a matrix known without looking at its elements
+ * Ordered from the weakest to the strongest, the structure of a combination of
+ * two matrices is at least the weaker one of them.
+ */
+enum class Structure {
+    GENERAL,  ///< nothing is known
+    UPPER,    ///< square, zero below the diagonal
+    DIAGONAL  ///< square, zero outside the diagonal
+};
+/**
+ * @brief weaker of two structures
+ * @return Structure: structure shared by both
+ */
+inline Structure meet(Structure a, Structure b) {
+    return a < b ? a : b;
+}
+/**
+ * @brief Form in which a matrix type keeps its elements, save writes only them
+ */
+enum class Layout {
+    DENSE,    ///< all rows, rows() x cols() storage
+    ZERO,     ///< no elements
+    IDENTITY, ///< no elements
+    DIAGONAL, ///< the diagonal, 1 x n storage
+    UPPER,    ///< the upper triangle packed row by row, 1 x n(n+1)/2 storage
+    SPARSE    ///< compressed rows of SparseMatrix
+};
+class LU;
 /**
  * @brief Generic Matrix class
  */
@@ -35,6 +157,13 @@ public:
      */
     Matrix(std::vector<std::vector<double>> data);
 
+    /**
+     * Construct a new generic Matrix sharing given storage
+     * @brief construct a new generic Matrix object
+     * @param data: contiguous storage
+     */
+    Matrix(Storage data);
+
     virtual ~Matrix() = default; ///< default destructor
  
     /**
@@ -57,16 +186,101 @@ public:
       */
     virtual std::shared_ptr<Matrix> transform();
 
+    /**
+     * Builds the most specific matrix type for given elements in a single pass over them.
+     * The pass stops at the first element below the diagonal which is not zero,
+     * the part excluded by a known structure is not read at all.
+     * @brief classify elements
+     * @param data: elements of the matrix, shared by the result
+     * @param known: structure the elements are known to have
+     * @return std::shared_ptr<Matrix>: pointer to the new matrix
+     */
+    static std::shared_ptr<Matrix> classify(Storage data, Structure known = Structure::GENERAL);
+
+    /**
+     * @brief structure guaranteed by the type of the matrix
+     * @return Structure: GENERAL for Matrix
+     */
+    virtual Structure structure() const;
+
     /**
      * @brief String representation of the matrix
      * @return std::string: string representation of the matrix
      */
     std::string toString() const;
+
+    /**
+     * Rows are written one by one, the text of the whole matrix is never built
+     * @brief write the string representation of the matrix
+     * @param os: output stream
+     */
+    void print(std::ostream& os) const;
+
+  // NOTE: compact form, every type exposes only the elements it keeps
+
+    /**
+     * @brief form in which the type keeps its elements
+     * @return Layout: DENSE for Matrix
+     */
+    virtual Layout layout() const;
+
+    /**
+     * @brief elements kept by the matrix, laid out as layout() says
+     * @return const Storage&: m_data, empty for ZERO, IDENTITY and SPARSE
+     */
+    const Storage& storage() const;
    
+  // NOTE: bulk access, one virtual call per block of rows instead of one per element
+
+    /**
+     * @brief true if m_data holds all elements as rows() x cols() row-major storage
+     * @return bool: true if dense() shares m_data
+     */
+    virtual bool isDenseStored() const;
+
+    /**
+     * Derived types fill rows from their own compact storage
+     * @brief write rows [first, last) as dense rows
+     * @param first: first row
+     * @param last: one past the last row
+     * @param out: destination, row i starts at out + (i - first) * ld
+     * @param ld: distance between two rows in out, at least cols()
+     */
+    virtual void copyRows(size_t first, size_t last, double* out, size_t ld) const;
+
+    /**
+     * @brief dense row of the matrix
+     * @param row: row index, not checked
+     * @param buffer: space for cols() elements, used if the matrix is not dense stored
+     * @return const double*: pointer to cols() elements of the row
+     */
+    const double* readRow(size_t row, double* buffer) const;
+
+    /**
+     * Element (i, j) is data[i * rowStride + j * colStride], dense stored matrices and views provide it
+     * @brief elements readable in place
+     * @param data: set to the first element
+     * @param rowStride: set to the distance between two rows
+     * @param colStride: set to the distance between two columns
+     * @return bool: false if elements have to be materialized by dense() first
+     */
+    virtual bool strided(const double*& data, size_t& rowStride, size_t& colStride) const;
+
+    /**
+     * Shares m_data of dense stored matrices, materializes other matrices
+     * @brief row-major storage of all elements
+     * @return Storage: rows() x cols() storage
+     */
+    Storage dense() const;
+
     virtual bool isEmpty() const;   ///< returns true if matrix is empty
     virtual bool isNumber() const;  ///< returns true if matrix is single number
     virtual bool isZero() const;    ///< returns true if matrix is zero matrix
     virtual bool isSquare() const;  ///< returns true if matrix is square matrix
+    virtual bool isSparse() const;  ///< returns true if only non-zero elements are stored
+    virtual bool isView() const;    ///< returns true if elements are read from the buffer of another matrix
+    virtual bool isBlock() const;   ///< returns true if the matrix is made of other matrices
+    virtual bool isFloat() const;   ///< returns true if elements are stored in single precision
 
   // NOTE: operators
     
@@ -118,9 +332,10 @@ public:
      */
     virtual std::shared_ptr<Matrix> div(const std::shared_ptr<Matrix> rhs) const;
     /**
+     * Square matrices are raised by repeated squaring, O(log rhs) products
      * @brief power matrix by scalar
-     * @param rhs: right hand side matrix (scalar) less or equal to 100
-     * @throw std::runtime_error: if matrix is not square
+     * @param rhs: right hand side matrix (non-negative integer scalar)
+     * @throw std::runtime_error: if matrix is not square or rhs is not a non-negative integer
      * @return std::shared_ptr<Matrix>: pointer to the new matrix
      */
     virtual std::shared_ptr<Matrix> power(const std::shared_ptr<Matrix> rhs) const;
@@ -151,21 +366,39 @@ public:
      */
     virtual std::shared_ptr<Matrix> crop(const std::shared_ptr<Matrix> rhs) const;
     /**
+     * Product of the actual pivots, no tolerance is applied: a matrix which rank() finds singular
+     * may still get a tiny nonzero determinant, e.g. the rounding residue of [1 2 3 & 4 5 6 & 7 8 9]
      * @brief get determinant of matrix
      * @throw std::runtime_error: if matrix is not square
      * @return std::shared_ptr<Matrix>: pointer to the new matrix
      */
     virtual std::shared_ptr<Matrix> det() const;
     /**
+     * Pivots not larger than LU::tolerance() are counted as zero, every type of matrix applies
+     * the same tolerance
      * @brief get rank of matrix
      * @return std::shared_ptr<Matrix>: pointer to the new matrix
      */
     virtual std::shared_ptr<Matrix> rank() const;
     /**
+     * Row echelon form from the LU factorization with partial pivoting
      * @brief do Gaussian elimination on matrix
      * @return std::shared_ptr<Matrix>: pointer to the new matrix
      */
     virtual std::shared_ptr<Matrix> gem() const;
+    /**
+     * @brief inverse of matrix
+     * @throw std::runtime_error: if matrix is not square or is singular
+     * @return std::shared_ptr<Matrix>: pointer to the new matrix
+     */
+    virtual std::shared_ptr<Matrix> inv() const;
+    /**
+     * @brief solve linear system, finds x such that this * x = rhs
+     * @param rhs: right hand side matrix with the same number of rows
+     * @throw std::runtime_error: if matrix is not square or is singular or rows differ
+     * @return std::shared_ptr<Matrix>: pointer to the new matrix
+     */
+    virtual std::shared_ptr<Matrix> solve(const std::shared_ptr<Matrix> rhs) const;
 
     /**
      * returns type name - "Matrix"
@@ -174,9 +407,53 @@ public:
      */
     virtual std::string whoami() const;
 
+    /**
+     * Applies to the calling thread only, operations timed repeatedly turn reuse off
+     * so every run pays for its factorization
+     * @brief keep and reuse factorizations of matrices
+     * @param reuse: false to factorize on every use without keeping the result
+     */
+    static void reuseFactorizations(bool reuse);
+
 protected:
-    std::vector<std::vector<double>> m_data; ///< vector of vectors to store matrix data
+    Storage m_data; ///< contiguous storage of matrix data
     bool m_empty; ///< true if matrix is empty
+    mutable std::shared_ptr<const LU> m_lu; ///< factorization, computed on first use
+    mutable std::shared_ptr<const LU> m_rankLU; ///< rank revealing factorization, when it differs from m_lu
+
+    /**
+     * Parameters are already checked by crop
+     * @brief submatrix
+     * @param top: index of the first row
+     * @param left: index of the first column
+     * @param rows: number of rows
+     * @param cols: number of columns
+     * @return std::shared_ptr<Matrix>: pointer to the new matrix
+     */
+    virtual std::shared_ptr<Matrix> region(size_t top, size_t left, size_t rows, size_t cols) const;
+
+    /**
+     * Matrices are immutable, the factorization is computed once and kept,
+     * det, inv and solve of the same matrix share it
+     * @brief LU factorization of the matrix
+     * @return std::shared_ptr<const LU>: pointer to the factorization
+     */
+    std::shared_ptr<const LU> factorization() const;
+
+    /**
+     * Same as factorization() unless the matrix has negligible pivots, then it is computed once more
+     * @brief rank revealing LU factorization of the matrix, used by rank and gem
+     * @return std::shared_ptr<const LU>: pointer to the factorization
+     */
+    std::shared_ptr<const LU> rankFactorization() const;
+
+    /**
+     * @brief exponent of a matrix power
+     * @param rhs: exponent (scalar)
+     * @throw std::runtime_error: if rhs is not a non-negative integer or does not fit 64 bits
+     * @return unsigned long long: exponent
+     */
+    static unsigned long long exponent(const std::shared_ptr<Matrix>& rhs);
 };
 /**
  * @brief Number class for scalar operations
@@ -279,6 +556,11 @@ public:
     virtual std::shared_ptr<Matrix> transform() override;
 
     virtual bool isZero() const override; ///< Always returns true
+    virtual Structure structure() const override; ///< DIAGONAL if square, GENERAL otherwise
+    virtual Layout layout() const override; ///< Always returns ZERO
+
+    virtual bool isDenseStored() const override; ///< Always returns false, nothing is stored
+    virtual void copyRows(size_t first, size_t last, double* out, size_t ld) const override;
 
     virtual double  get(size_t row, size_t col) const override;
     virtual std::shared_ptr<Matrix> add(const std::shared_ptr<Matrix> rhs) const override;      
@@ -317,6 +599,11 @@ public:
      * @param m: matrix
      */
     SquareMatrix(const Matrix& m);
+    /**
+     * Constructs a SquareMatrix sharing given storage
+     * @param data: square storage
+     */
+    SquareMatrix(Storage data);
     virtual size_t rows() const override;
     virtual size_t cols() const override;
 
@@ -346,6 +633,8 @@ protected:
 };
 /**
  * @brief TriangularMatrix class for triangular matrices
+ *
+ * Upper triangle is stored packed, n(n+1)/2 elements in one buffer.
  */
 class TriangularMatrix : public SquareMatrix {
 public:
@@ -367,6 +656,18 @@ public:
      * @param m: square matrix
      */
     TriangularMatrix(const SquareMatrix& m);
+    /**
+     * Constructs a TriangularMatrix from the upper triangle of a dense buffer,
+     * elements below the diagonal are not read
+     * @param data: square storage
+     */
+    TriangularMatrix(const Storage& data);
+    /**
+     * Constructs a TriangularMatrix sharing a packed upper triangle
+     * @param size: number of rows and columns
+     * @param packed: 1 x n(n+1)/2 storage laid out as storage() of a TriangularMatrix
+     */
+    TriangularMatrix(size_t size, Storage packed);
 
     /**
      * Transform the TriangularMatrix to a more specific type
@@ -378,13 +679,67 @@ public:
 
     virtual bool isTriangular() const override; ///< Always returns true
     virtual bool isDiagonal() const; ///< Returns true if matrix is diagonal
+    virtual Structure structure() const override; ///< Always returns UPPER
+    virtual Layout layout() const override; ///< Always returns UPPER
+
+    virtual bool isDenseStored() const override; ///< Always returns false, the upper triangle is packed
+    virtual void copyRows(size_t first, size_t last, double* out, size_t ld) const override;
 
     virtual double get(size_t row, size_t col) const override; 
 
+    /**
+     * Product of two triangular matrices multiplies only blocks on and above the diagonal
+     * @brief multiply matrix by another matrix or scalar
+     */
+    virtual std::shared_ptr<Matrix> prod(const std::shared_ptr<Matrix> rhs) const override;
+    /**
+     * Repeated squaring with the triangular product, the result stays triangular
+     * @brief power matrix by scalar
+     */
+    virtual std::shared_ptr<Matrix> power(const std::shared_ptr<Matrix> rhs) const override;
+    /**
+     * Product of the diagonal
+     * @brief Determinant
+     */
+    virtual std::shared_ptr<Matrix> det() const override;
+    /**
+     * Number of rows when no element of the diagonal is negligible, see LU::tolerance()
+     * @brief rank of matrix
+     */
+    virtual std::shared_ptr<Matrix> rank() const override;
+    /**
+     * Triangular matrix with no negligible element on the diagonal already is in row echelon form
+     * @brief gaussian elimination
+     */
+    virtual std::shared_ptr<Matrix> gem() const override;
+
     virtual std::string whoami() const override; ///< returns type name - "TriangularMatrix"
+
+protected:
+    /**
+     * Upper triangle is packed row by row into m_data, a 1 x n(n+1)/2 storage,
+     * row i holds elements i to n - 1
+     * @brief position of the diagonal element of a row in the packed buffer
+     * @param row: row index, row equal to n gives the size of the buffer
+     * @return size_t: offset in m_data
+     */
+    size_t offset(size_t row) const;
+
+    /**
+     * The pivots of an upper triangular matrix are its diagonal, so this is the tolerance
+     * the rank revealing LU factorization would apply to them
+     * @brief largest element of the diagonal treated as zero by rank and gem
+     * @return double: LU::tolerance() of the stored elements
+     */
+    double tolerance() const;
+
+private:
+    void pack(const Matrix& m); ///< packs the upper triangle of any square matrix into m_data
 };
 /**
  * @brief DiagonalMatrix class for diagonal matrices
+ *
+ * Only the diagonal is stored, as a flat 1 x n storage in m_data.
  */
 class DiagonalMatrix : public TriangularMatrix { 
 public:
@@ -406,6 +761,17 @@ public:
      * @param m: triangular matrix
      */
     DiagonalMatrix(const TriangularMatrix& m);
+    /**
+     * Constructs a DiagonalMatrix from the diagonal of given storage
+     * @param data: square storage
+     */
+    DiagonalMatrix(const Storage& data);
+    /**
+     * Constructs a DiagonalMatrix sharing a stored diagonal
+     * @param size: number of rows and columns
+     * @param diagonal: 1 x n storage with the diagonal
+     */
+    DiagonalMatrix(size_t size, Storage diagonal);
 
     /**
      * Transform the DiagonalMatrix to a more specific type
@@ -417,10 +783,53 @@ public:
 
     virtual bool isDiagonal() const override; ///< Always returns true
     virtual bool isIdentity() const; ///< Returns true if matrix is identity
+    virtual Structure structure() const override; ///< Always returns DIAGONAL
+    virtual Layout layout() const override; ///< Always returns DIAGONAL
+
+    virtual bool isDenseStored() const override; ///< Always returns false, only the diagonal is stored
+    virtual void copyRows(size_t first, size_t last, double* out, size_t ld) const override;
 
     virtual double get(size_t row, size_t col) const override;
 
+    /**
+     * Sum with a diagonal matrix adds only the diagonals
+     * @brief add matrix to matrix
+     */
+    virtual std::shared_ptr<Matrix> add(const std::shared_ptr<Matrix> rhs) const override;
+    /**
+     * Difference with a diagonal matrix subtracts only the diagonals
+     * @brief subtract matrix from matrix
+     */
+    virtual std::shared_ptr<Matrix> sub(const std::shared_ptr<Matrix> rhs) const override;
+    /**
+     * Scales rows of rhs, product with a diagonal matrix multiplies only the diagonals
+     * @brief multiply matrix by another matrix or scalar
+     */
+    virtual std::shared_ptr<Matrix> prod(const std::shared_ptr<Matrix> rhs) const override;
+    /**
+     * Every element of the diagonal is raised separately
+     * @brief power matrix by scalar
+     */
+    virtual std::shared_ptr<Matrix> power(const std::shared_ptr<Matrix> rhs) const override;
+    virtual std::shared_ptr<Matrix> transpose() const override; ///< Returns itself
+    /**
+     * Number of elements of the diagonal which are not negligible, see LU::tolerance()
+     * @brief rank of matrix
+     */
+    virtual std::shared_ptr<Matrix> rank() const override;
+    virtual std::shared_ptr<Matrix> gem() const override; ///< Returns itself when no element of the diagonal is negligible
+    virtual std::shared_ptr<Matrix> inv() const override; ///< Inverts every element of the diagonal
+    virtual std::shared_ptr<Matrix> solve(const std::shared_ptr<Matrix> rhs) const override; ///< Divides rows of rhs by the diagonal
+
     virtual std::string whoami() const override; ///< returns type name - "DiagonalMatrix"
+
+    /**
+     * Zero or identity diagonal gives ZeroMatrix or IdentityMatrix
+     * @brief matrix with given diagonal
+     * @param diagonal: 1 x n storage with the diagonal
+     * @return std::shared_ptr<Matrix>: pointer to the new matrix
+     */
+    static std::shared_ptr<Matrix> fromDiagonal(Storage diagonal);
 };
 /**
  * @brief IdentityMatrix class for identity matrices
@@ -452,8 +861,372 @@ public:
     virtual std::shared_ptr<Matrix> transform() override;
 
     virtual bool isIdentity() const override; ///< Always returns true
+    virtual Layout layout() const override; ///< Always returns IDENTITY
+
+    virtual void copyRows(size_t first, size_t last, double* out, size_t ld) const override;
 
     virtual double get(size_t row, size_t col) const override;
 
+    /**
+     * Product with a matrix is the matrix itself, nothing is copied
+     * @brief multiply matrix by another matrix or scalar
+     */
+    virtual std::shared_ptr<Matrix> prod(const std::shared_ptr<Matrix> rhs) const override;
+    virtual std::shared_ptr<Matrix> power(const std::shared_ptr<Matrix> rhs) const override; ///< Always returns identity
+    virtual std::shared_ptr<Matrix> transpose() const override; ///< Returns itself
+    virtual std::shared_ptr<Matrix> gem() const override; ///< Returns itself
+    virtual std::shared_ptr<Matrix> inv() const override; ///< Returns itself
+    virtual std::shared_ptr<Matrix> solve(const std::shared_ptr<Matrix> rhs) const override; ///< Returns rhs
+
     virtual std::string whoami() const override; ///< returns type name - "IdentityMatrix"
 };
+/**
+ * @brief SparseMatrix class for matrices with few non-zero elements
+ *
+ * Non-zero elements are stored in compressed sparse row form (CSR), explicit zeros are never stored.
+ * Matrices of at least MIN_ELEMENTS elements with at most DENSITY of them non-zero are sparse,
+ * unless they are zero, diagonal or identity matrices.
+ */
+class SparseMatrix : public Matrix {
+public:
+    static constexpr double DENSITY = 0.05;        ///< largest share of non-zero elements
+    static constexpr size_t MIN_ELEMENTS = 4096;   ///< smaller matrices are kept dense
+
+    /**
+     * @brief compressed rows
+     */
+    struct Csr {
+        std::vector<size_t> offsets; ///< start of every row in columns and values, one more than rows
+        std::vector<size_t> columns; ///< column of every element, increasing within a row
+        std::vector<double> values;  ///< non-zero elements
+    };
+
+    /**
+     * Constructs a SparseMatrix from non-zero elements of a dense buffer
+     * @param data: dense storage
+     */
+    SparseMatrix(const Storage& data);
+    /**
+     * Constructs a SparseMatrix from compressed rows
+     * @param rows: number of rows
+     * @param cols: number of columns
+     * @param csr: compressed rows without zeros
+     */
+    SparseMatrix(size_t rows, size_t cols, Csr csr);
+    /**
+     * Constructs a SparseMatrix from another SparseMatrix, the compressed rows are shared
+     * @brief copy constructor
+     * @param m: sparse matrix
+     */
+    SparseMatrix(const SparseMatrix& m);
+
+    /**
+     * @brief largest number of non-zero elements of a sparse matrix of given size
+     * @param rows: number of rows
+     * @param cols: number of columns
+     * @return size_t: 0 if matrices of this size are always dense
+     */
+    static size_t maxNonzeros(size_t rows, size_t cols);
+    /**
+     * Picks ZeroMatrix, Number, DiagonalMatrix or IdentityMatrix when they fit, SparseMatrix when
+     * there are few non-zero elements and a dense type otherwise
+     * @brief matrix from compressed rows
+     * @param rows: number of rows
+     * @param cols: number of columns
+     * @param csr: compressed rows without zeros
+     * @return std::shared_ptr<Matrix>: pointer to the new matrix
+     */
+    static std::shared_ptr<Matrix> build(size_t rows, size_t cols, Csr csr);
+
+    virtual size_t rows() const override;
+    virtual size_t cols() const override;
+    const Csr& csr() const; ///< compressed rows
+    size_t nonzeros() const; ///< number of stored elements
+
+    /**
+     * Can be nedded for virtual inheritance from it, always returns itself
+     */
+    virtual std::shared_ptr<Matrix> transform() override;
+
+    virtual bool isZero() const override; ///< Returns true if nothing is stored
+    virtual bool isSparse() const override; ///< Always returns true
+    virtual Layout layout() const override; ///< Always returns SPARSE
+
+    virtual bool isDenseStored() const override; ///< Always returns false
+    virtual void copyRows(size_t first, size_t last, double* out, size_t ld) const override;
+
+    virtual double get(size_t row, size_t col) const override;
+
+    /**
+     * Sum of sparse matrices merges their rows, any other sum is dense
+     * @brief add matrix to matrix
+     */
+    virtual std::shared_ptr<Matrix> add(const std::shared_ptr<Matrix> rhs) const override;
+    virtual std::shared_ptr<Matrix> neg() const override;
+    virtual std::shared_ptr<Matrix> sub(const std::shared_ptr<Matrix> rhs) const override;
+    /**
+     * Product with a sparse matrix is sparse (row by row Gustavson algorithm),
+     * product with a dense matrix adds scaled rows of rhs
+     * @brief multiply matrix by another matrix or scalar
+     */
+    virtual std::shared_ptr<Matrix> prod(const std::shared_ptr<Matrix> rhs) const override;
+    virtual std::shared_ptr<Matrix> power(const std::shared_ptr<Matrix> rhs) const override;
+    virtual std::shared_ptr<Matrix> transpose() const override;
+    virtual std::shared_ptr<Matrix> hconcat(const std::shared_ptr<Matrix> rhs) const override;
+    virtual std::shared_ptr<Matrix> vconcat(const std::shared_ptr<Matrix> rhs) const override;
+    virtual std::shared_ptr<Matrix> det() const override;
+
+    virtual std::string whoami() const override; ///< returns type name - "SparseMatrix"
+
+protected:
+    size_t m_rows;
+    size_t m_cols;
+    std::shared_ptr<const Csr> m_csr; ///< compressed rows, shared by copies
+
+    virtual std::shared_ptr<Matrix> region(size_t top, size_t left, size_t rows, size_t cols) const override;
+};
+/**
+ * @brief ViewMatrix class for crops and transposes of dense matrices
+ *
+ * Shares the buffer of the matrix it was taken from and reads it through an offset and
+ * two strides, so crop and transpose copy nothing. Only elements which classify would keep
+ * as a plain Matrix or SquareMatrix are viewed, so a view has the type and structure of
+ * the copy it stands for. Products read views in place, other operations materialize them
+ * with dense().
+ */
+class ViewMatrix : public Matrix {
+public:
+    static constexpr size_t MIN_ELEMENTS = 4096; ///< smaller crops and transposes are copied and classified
+
+    /**
+     * @brief constructor
+     * @param parent: buffer of the viewed matrix, shared
+     * @param offset: position of element (0, 0) in the buffer
+     * @param rows: number of rows
+     * @param cols: number of columns
+     * @param rowStride: distance between two rows in the buffer
+     * @param colStride: distance between two columns in the buffer
+     */
+    ViewMatrix(Storage parent, size_t offset, size_t rows, size_t cols, size_t rowStride, size_t colStride);
+    ViewMatrix(const ViewMatrix& m);
+
+    /**
+     * Views of at least MIN_ELEMENTS elements stay views unless their elements are triangular,
+     * diagonal or sparse, smaller and structured ones are copied and classified
+     * @brief view or copy of a part of a buffer, parameters as in the constructor
+     * @return std::shared_ptr<Matrix>: pointer to the new matrix
+     */
+    static std::shared_ptr<Matrix> create(Storage parent, size_t offset, size_t rows, size_t cols, size_t rowStride, size_t colStride);
+
+    virtual size_t rows() const override;
+    virtual size_t cols() const override;
+
+    /**
+     * Copies the elements into a buffer of their own and classifies them
+     * @brief Matrix casting
+     * @return std::shared_ptr<Matrix>: pointer to the new matrix
+     */
+    virtual std::shared_ptr<Matrix> transform() override;
+
+    virtual bool isView() const override; ///< Always returns true
+    /**
+     * @brief true if nothing but this view holds the parent buffer and the view uses only a part of it
+     */
+    bool holdsParentAlone() const;
+
+    virtual bool isDenseStored() const override; ///< Always returns false
+    virtual void copyRows(size_t first, size_t last, double* out, size_t ld) const override;
+    virtual bool strided(const double*& data, size_t& rowStride, size_t& colStride) const override;
+
+    virtual double get(size_t row, size_t col) const override;
+
+    /**
+     * @brief power of a square view, computed on its materialized elements
+     */
+    virtual std::shared_ptr<Matrix> power(const std::shared_ptr<Matrix> rhs) const override;
+    virtual std::shared_ptr<Matrix> transpose() const override; ///< Swaps the strides, nothing is copied
+    virtual std::shared_ptr<Matrix> det() const override;
+
+    virtual std::string whoami() const override; ///< returns type name of the copy - "Square Matrix" or "Matrix"
+
+protected:
+    Storage m_parent;   ///< buffer of the viewed matrix
+    size_t m_offset;    ///< position of element (0, 0) in m_parent
+    size_t m_rows;
+    size_t m_cols;
+    size_t m_rowStride; ///< distance between two rows in m_parent
+    size_t m_colStride; ///< distance between two columns in m_parent
+
+    virtual std::shared_ptr<Matrix> region(size_t top, size_t left, size_t rows, size_t cols) const override; ///< View of the view
+};
+
+/**
+ * @brief BlockMatrix class for concatenations of large matrices
+ *
+ * Keeps a grid of the concatenated matrices instead of copying them, all blocks of a grid row have
+ * the same number of rows and all blocks of a grid column the same number of columns.
+ * Elements are materialized once, when an operation needs them dense. Determinant of a block
+ * triangular matrix is the product of determinants of its diagonal blocks, products are computed
+ * block by block and zero blocks are skipped.
+ */
+class BlockMatrix : public Matrix {
+public:
+    typedef std::vector<std::vector<std::shared_ptr<Matrix>>> Grid; ///< blocks row by row
+
+    static constexpr size_t MIN_ELEMENTS = 4096; ///< smaller concatenations are copied and classified
+
+    /**
+     * @brief constructor
+     * @param blocks: grid of blocks with matching sizes, not checked
+     */
+    BlockMatrix(Grid blocks);
+    BlockMatrix(const BlockMatrix& m);
+
+    /**
+     * Large results keep both matrices as blocks, grids of block matrices are merged if their rows line up
+     * @brief horizontal concatenation of two matrices
+     * @throw std::runtime_error: if matrices have different number of rows
+     * @return std::shared_ptr<Matrix>: pointer to the new matrix
+     */
+    static std::shared_ptr<Matrix> hconcat(std::shared_ptr<Matrix> lhs, std::shared_ptr<Matrix> rhs);
+    /**
+     * Large results keep both matrices as blocks, grids of block matrices are merged if their columns line up
+     * @brief vertical concatenation of two matrices
+     * @throw std::runtime_error: if matrices have different number of columns
+     * @return std::shared_ptr<Matrix>: pointer to the new matrix
+     */
+    static std::shared_ptr<Matrix> vconcat(std::shared_ptr<Matrix> lhs, std::shared_ptr<Matrix> rhs);
+
+    virtual size_t rows() const override;
+    virtual size_t cols() const override;
+
+    /**
+     * Copies all blocks into one buffer and classifies it
+     * @brief Matrix casting
+     * @return std::shared_ptr<Matrix>: pointer to the new matrix
+     */
+    virtual std::shared_ptr<Matrix> transform() override;
+
+    virtual bool isBlock() const override; ///< Always returns true
+    const Grid& blocks() const; ///< blocks row by row
+
+    virtual bool isDenseStored() const override; ///< Always returns false
+    virtual void copyRows(size_t first, size_t last, double* out, size_t ld) const override;
+
+    virtual double get(size_t row, size_t col) const override;
+
+    /**
+     * Scalars scale every block, rows of blocks are multiplied block by block
+     * @brief multiply matrix with matrix
+     */
+    virtual std::shared_ptr<Matrix> prod(const std::shared_ptr<Matrix> rhs) const override;
+    /**
+     * @brief power of a square block matrix, computed on its materialized elements
+     */
+    virtual std::shared_ptr<Matrix> power(const std::shared_ptr<Matrix> rhs) const override;
+    virtual std::shared_ptr<Matrix> transpose() const override; ///< Transposes the grid and every block
+    /**
+     * @brief product of determinants of diagonal blocks if all blocks above or below them are zero
+     */
+    virtual std::shared_ptr<Matrix> det() const override;
+
+    virtual std::string whoami() const override; ///< returns type name - "Block Matrix"
+
+protected:
+    Grid m_blocks;                  ///< blocks row by row
+    std::vector<size_t> m_rowStart; ///< first row of every grid row, followed by rows()
+    std::vector<size_t> m_colStart; ///< first column of every grid column, followed by cols()
+};
+
+/**
+ * @brief FloatMatrix class for dense matrices kept in single precision
+ *
+ * Elements are 32-bit floats, half the memory of a dense double matrix, rows are padded to whole
+ * cache lines like in Storage. Computations widen the elements to double: gemm widens them while
+ * packing its panels and accumulates in double, factorizations work on a double copy.
+ * Results of operations whose matrix operands are all float matrices are rounded to float once,
+ * at the end, mixing with double matrices gives double results and numbers stay double.
+ * Only dense matrices are ever converted, other types already keep just the elements they need.
+ */
+class FloatMatrix : public Matrix {
+public:
+    static constexpr size_t LANES = Storage::ALIGNMENT / sizeof(float); ///< floats per cache line
+
+    /**
+     * Wraps a buffer allocated by the matrix operations or elsewhere, e.g. a mapped file, it is released by the deleter of the pointer
+     * @brief constructor
+     * @param buffer: ALIGNMENT aligned elements, rows padded to paddedStride(cols) elements
+     * @param rows: number of rows
+     * @param cols: number of columns
+     */
+    FloatMatrix(std::shared_ptr<float> buffer, size_t rows, size_t cols);
+    FloatMatrix(const FloatMatrix& m);
+
+    /**
+     * @brief distance between starts of two rows of given width, the same rule as in Storage
+     */
+    static size_t paddedStride(size_t cols);
+
+    /**
+     * @brief single precision copy of a dense matrix, any other matrix is returned as it is
+     * @param m: matrix to convert
+     * @return std::shared_ptr<Matrix>: pointer to the converted matrix
+     */
+    static std::shared_ptr<Matrix> narrow(const std::shared_ptr<Matrix>& m);
+    /**
+     * @brief double precision copy of a float matrix, classified, any other matrix is returned as it is
+     * @param m: matrix to convert
+     * @return std::shared_ptr<Matrix>: pointer to the converted matrix
+     */
+    static std::shared_ptr<Matrix> widen(const std::shared_ptr<Matrix>& m);
+    /**
+     * Float elements are read in place and widened by gemm, double operands are read in place
+     * when they are dense stored or views
+     * @brief product of two matrices, at least one of them a float matrix
+     * @return std::shared_ptr<Matrix>: float matrix if both are float matrices, classified double otherwise
+     */
+    static std::shared_ptr<Matrix> multiply(const Matrix& lhs, const Matrix& rhs);
+
+    virtual size_t rows() const override;
+    virtual size_t cols() const override;
+    virtual std::shared_ptr<Matrix> transform() override; ///< stays a float matrix
+
+    virtual bool isFloat() const override; ///< Always returns true
+    const float* values() const; ///< pointer to the first element
+    size_t stride() const;       ///< distance between starts of two consecutive rows in elements
+
+    virtual bool isDenseStored() const override; ///< Always returns false, elements are not doubles
+    virtual void copyRows(size_t first, size_t last, double* out, size_t ld) const override;
+
+    virtual double get(size_t row, size_t col) const override;
+
+    virtual std::shared_ptr<Matrix> add(const std::shared_ptr<Matrix> rhs) const override;
+    virtual std::shared_ptr<Matrix> neg() const override;
+    virtual std::shared_ptr<Matrix> sub(const std::shared_ptr<Matrix> rhs) const override;
+    /**
+     * Scalars scale the floats directly, matrices are multiplied by multiply()
+     * @brief multiply matrix with matrix
+     */
+    virtual std::shared_ptr<Matrix> prod(const std::shared_ptr<Matrix> rhs) const override;
+    /**
+     * @brief power of a square float matrix, computed in double and rounded once
+     */
+    virtual std::shared_ptr<Matrix> power(const std::shared_ptr<Matrix> rhs) const override;
+    virtual std::shared_ptr<Matrix> transpose() const override;
+    virtual std::shared_ptr<Matrix> hconcat(const std::shared_ptr<Matrix> rhs) const override;
+    virtual std::shared_ptr<Matrix> vconcat(const std::shared_ptr<Matrix> rhs) const override;
+    virtual std::shared_ptr<Matrix> det() const override;
+    virtual std::shared_ptr<Matrix> gem() const override;
+    virtual std::shared_ptr<Matrix> inv() const override;
+    virtual std::shared_ptr<Matrix> solve(const std::shared_ptr<Matrix> rhs) const override;
+
+    virtual std::string whoami() const override; ///< returns type name - "Float Matrix"
+
+protected:
+    std::shared_ptr<float> m_values; ///< aligned rows of elements, shared by copies
+    size_t m_rows;
+    size_t m_cols;
+    size_t m_stride; ///< row stride in elements
+
+    virtual std::shared_ptr<Matrix> region(size_t top, size_t left, size_t rows, size_t cols) const override;
+};
@@ -3,12 +3,37 @@
  * @author morozan1
  * @brief Parser and Lexer for Matrix Calculator
  */
+#pragma once
 #include "matrix.hxx"
+#include "expression.hxx"
+#include "cache.hxx"
 #include <map>
+#include <set>
 #include <fstream>
 #include <iostream>
+#include <string_view>
+/**
+ * @brief Kind of a token, decided once when the token is read
+ */
+enum class TokenKind {
+    END,        ///< end of the input line
+    NUMBER,     ///< the whole token is a number
+    IDENTIFIER, ///< name of a variable, command or file
+    OPERATOR    ///< single character token
+};
+/**
+ * @brief Token pointing into the current input line
+ */
+struct Token {
+    TokenKind kind = TokenKind::END;
+    std::string_view text; ///< characters of the token, valid until the next line is read
+    double number = 0;     ///< value of a NUMBER token
+};
 /**
  * @brief Lexer that reads input from std::cin and returns tokens
+ *
+ * Tokens are views into the current line, numbers are parsed once by the lexer.
+ * One token is read ahead, so peeking does not read it again.
  */
 class Lexer {
 public:
@@ -24,25 +49,34 @@ public:
     /**
      * @brief Get current token
      */
-    std::string getCurrentToken() const;
+    const Token& current() const;
+    /**
+     * @brief Get text of current token
+     */
+    std::string_view getCurrentToken() const;
+    /**
+     * @brief Get text of next token
+     */
+    std::string_view peekToken() const;
     /**
-     * @brief Get next token
+     * @brief Advance and get text of the new current token
      */
-    std::string peekToken();
+    std::string_view getNextToken();
     /**
-     * @brief Get next token and advance
+     * @brief Get text of the current line from the current token on
      */
-    std::string getNextToken();
+    std::string_view rest() const;
 
 private:
     std::istream& m_is; ///< input stream
-    std::string m_input, m_token; ///< current input line and current token
-    size_t m_pos; ///< current position in input line
+    std::string m_input; ///< current input line
+    Token m_token, m_next; ///< current token and the one after it
+    size_t m_pos; ///< position in input line after m_next
     // NOTE: token is either single char or string of digits or letters
     /**
      * @brief calculate next token
      */
-    std::string nextToken();
+    Token nextToken();
 };
 /**
  * @brief Parser that reads tokens from Lexer and returns matrices by its grammar rules
@@ -64,49 +98,142 @@ public :
      * @brief Parse tokens from Lexer
      */
     std::shared_ptr<Matrix> parse();
+    /**
+     * Nothing is prompted, blank lines are skipped and the script ends with the input or with exit.
+     * Statements are scheduled by the variables and files they read and write: a statement runs
+     * after the statements which last wrote what it reads and writes and after the earlier readers
+     * of what it writes. Independent statements run in parallel, their output is still written in
+     * the order of the script. save runs after all earlier statements, threads, cache, stats, time
+     * and bench run alone.
+     * The first failed statement stops the script, statements before it still run. Variables written
+     * by later statements are discarded, but those which ran in parallel with the failed one may
+     * already have saved their files.
+     * @brief batch mode, runs statements from the input stream
+     * @param errors: stream for the error which stopped the script
+     * @return int: 0 if all statements succeeded, 1 otherwise
+     */
+    int runScript(std::ostream& errors = std::cerr);
 
 private:
+    /**
+     * @brief line of a script and what it uses
+     */
+    struct Statement {
+        std::string text;                   ///< the line
+        size_t line = 0;                    ///< number of the line in the script
+        size_t level = 0;                   ///< statements run level by level
+        std::set<std::string> reads;        ///< variables read
+        std::set<std::string> writes;       ///< variables written
+        std::set<std::string> loads, saves; ///< files read and written, by variable name
+        bool ordered = false;               ///< runs after all earlier statements
+        bool barrier = false;               ///< runs after all earlier statements and before all later ones
+        bool exit = false;                  ///< ends the script
+    };
+
     std::string m_workingDirectory; ///< directory where to read/write files
     std::ostream& m_os; ///< output stream
     std::istream& m_is; ///< input stream
-    std::map<std::string, std::shared_ptr<Matrix> > m_matrices; ///< map of matrices
+    std::map<std::string, std::shared_ptr<Matrix>, std::less<> > m_matrices; ///< map of matrices, looked up by token text
     Lexer m_lexer; ///< lexer
+    std::shared_ptr<ResultCache> m_cache; ///< results of unary operations, products and powers, shared with statements run in parallel
     bool m_running; ///< is REPL running
 
     /**
+     * Without an extension NAME.matb is read if it exists, NAME.matix otherwise.
+     * Binary files are told from text files by their magic bytes.
+     * Throughput of loading a text file of at least a megabyte is reported.
      * @brief read matrix from file
-     * @param filename: name of file
+     * @param filename: name of file, optionally with extension
      */
     std::shared_ptr<Matrix> readFromFile(std::string filename);
     
     /**
+     * Text is written only to NAME.matix, anything else is written in the binary format.
+     * The matrix is written to a temporary file which then replaces the target, so a matrix
+     * loaded from the target, whose elements are still mapped from it, can be saved over it.
      * @brief write matrix to file
-     * @param filename: name of file
+     * @param filename: name of file, NAME.matb if there is no extension
      * @param matrix: matrix to write
      */
     void writeToFile(std::string filename, std::shared_ptr<Matrix> matrix);
+
+    /**
+     * @brief parse the current line and print its result
+     * @throw std::exception: if the statement fails
+     */
+    void execute();
+
+    /**
+     * @brief variables and files used by a line of a script
+     * @param line: statement
+     */
+    static Statement analyze(const std::string& line);
+
+    /**
+     * A view of a matrix which was reassigned keeps its whole buffer alive, such views are
+     * copied into buffers of their own size
+     * @brief materialize variables which are the last views of their parent
+     */
+    void releaseViews();
+
+    /**
+     * @brief result of an operation, computed only if m_cache does not have it
+     * @param op: name of the operation
+     * @param lhs: first operand
+     * @param rhs: second operand, nullptr for unary operations
+     * @param compute: computes the result
+     */
+    std::shared_ptr<Expression> cached(const std::string& op, const std::shared_ptr<Matrix>& lhs, const std::shared_ptr<Matrix>& rhs,
+                                       const std::function<std::shared_ptr<Matrix>()>& compute);
+
+    /**
+     * Results computed from the matrix previously stored under the name are dropped from m_cache
+     * @brief assign a matrix to a variable
+     */
+    void store(const std::string& name, std::shared_ptr<Matrix> matrix);
     
-    std::shared_ptr<Matrix>  parseRow(); ///< parse a row
     /**
-     * Parse a matrix [row & row & row & ...]
+     * @brief parse a row
+     * @param elements: elements of the row are appended to it
+     * @return size_t: number of elements in the row
+     */
+    size_t parseRow(std::vector<double>& elements);
+    /**
+     * Parse a matrix [row & row & row & ...], its storage is allocated once after all rows are parsed
      * @throws std::invalid_argument if matrix is invalid
      */
     std::shared_ptr<Matrix>  parseMatrix();
 
-    std::shared_ptr<Matrix>  parseUnary(); ///< negation, transpose, GEM, determinant, rank, parenthesis, variable
+    std::shared_ptr<Expression> parseUnary(); ///< negation, transpose, GEM, determinant, rank, parenthesis, variable
 
-    std::shared_ptr<Matrix>  parseBackslash(); ///< parse submatrix operation(crop)
+    std::shared_ptr<Expression> parseBackslash(); ///< parse submatrix operation(crop)
 
-    std::shared_ptr<Matrix>  parsePower(); ///< parse power operation
+    std::shared_ptr<Expression> parsePower(); ///< parse power operation
 
-    std::shared_ptr<Matrix>  parseAnd(); ///< parse vertical concatenation operation(&)
+    std::shared_ptr<Expression> parseAnd(); ///< parse vertical concatenation operation(&)
 
-    std::shared_ptr<Matrix>  parseOr(); ///< parse horizontal concatenation operation(|)
+    std::shared_ptr<Expression> parseOr(); ///< parse horizontal concatenation operation(|)
 
-    std::shared_ptr<Matrix>  parseMulDiv(); ///< parse multiplication and division operations
+    std::shared_ptr<Expression> parseMulDiv(); ///< parse multiplication and division operations
 
-    std::shared_ptr<Matrix>  parseAddSub(); ///< parse addition and subtraction operations
+    std::shared_ptr<Expression> parseAddSub(); ///< parse addition and subtraction operations
 
     std::shared_ptr<Matrix>  parseAssign(); ///< parse assignment operation and commands
 
+    /**
+     * The expression is evaluated as in any other statement, its result is not printed.
+     * Peak allocation is the highest amount of matrix elements allocated during the evaluation
+     * above what was allocated before it.
+     * @brief time EXPR, report wall and CPU time, peak allocation and type of the result
+     */
+    std::shared_ptr<Matrix>  parseTime();
+
+    /**
+     * Every run parses the expression again with the result cache turned off and without
+     * reusing factorizations, so nothing computed by an earlier run is reused.
+     * @brief bench N EXPR, evaluate an expression N times and report min, median and p99 time
+     * @throws std::invalid_argument if N is not a positive integer or the expression is missing
+     */
+    std::shared_ptr<Matrix>  parseBench();
+
 };
@@ -0,0 +1,124 @@
+/**
+ * @file profile.hxx
+ * @author morozan1
+ * @brief Counters and timers of hot paths
+ */
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+/**
+ * @brief Calls, time, allocated bytes and floating point operations of instrumented places
+ *
+ * Every instrumented place has a Site, a Scope placed in it counts one call and its duration.
+ * Profiling is off unless MTRX_PROFILE or MTRX_TRACE is set or it is turned on with enable().
+ * A Scope of a disabled profile is one relaxed atomic load and a branch. Times of nested scopes
+ * are included in the times of the outer ones, allocations are counted by every scope open on
+ * the allocating thread. While tracing, every scope is also recorded as
+ * a Chrome trace event, events are written to the trace file when tracing stops or the program exits.
+ */
+namespace profile {
+    /**
+     * @brief counters of one instrumented place, registered for report() on construction
+     */
+    struct Site {
+        /**
+         * @brief constructor
+         * @param name: name printed by report(), the string must outlive the site
+         */
+        Site(const char* name);
+
+        const char* name;
+        std::atomic<uint64_t> calls;        ///< completed scopes
+        std::atomic<uint64_t> nanoseconds;  ///< total duration of the scopes
+        std::atomic<uint64_t> bytes;        ///< bytes allocated
+        std::atomic<uint64_t> flops;        ///< floating point operations
+    };
+
+    extern std::atomic<bool> active; ///< true if counters are updated
+
+    inline bool enabled() {
+        return active.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Kept in the header, so a disabled scope costs nothing more than the check
+     * @brief counts a call of a site and its duration
+     */
+    class Scope {
+    public:
+        /**
+         * @brief constructor
+         * @param site: counted site, nullptr counts nothing
+         * @param flops: floating point operations done in the scope
+         */
+        Scope(Site* site, uint64_t flops = 0) : m_site(nullptr), m_flops(flops) {
+            if (site != nullptr && enabled())
+                start(site);
+        }
+        ~Scope() {
+            if (m_site != nullptr)
+                finish();
+        }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        Site* m_site;
+        uint64_t m_flops;
+        Scope* m_outer; ///< scope open on this thread when this one started
+        std::chrono::steady_clock::time_point m_start;
+
+        void start(Site* site); ///< opens the scope on this thread
+        void finish();          ///< adds the call to the site and records the trace event
+
+        friend void allocated(size_t bytes, bool reused);
+    };
+
+    /**
+     * @brief site of a name known only at runtime, created on first use
+     * @param name: name of the site
+     * @return Site*: the site, nullptr if profiling is off
+     */
+    Site* site(const std::string& name);
+
+    /**
+     * Live and peak bytes are kept even when profiling is off
+     * @brief count an allocation in the allocator site and in all scopes open on this thread
+     * @param bytes: size of the allocation
+     * @param reused: true if a released buffer was handed out again instead of a new one
+     */
+    void allocated(size_t bytes, bool reused = false);
+    /**
+     * @brief count a release of an allocation counted by allocated()
+     * @param bytes: size of the allocation
+     */
+    void released(size_t bytes);
+
+    uint64_t liveBytes(); ///< bytes allocated and not yet released, in all threads
+    uint64_t peakBytes(); ///< highest liveBytes() since the last resetPeak()
+    void resetPeak();     ///< start measuring the peak from liveBytes()
+
+    void enable(bool on); ///< turn counting on or off
+    void reset();         ///< zero all counters
+
+    /**
+     * @brief print counters of all sites which were called, slowest first
+     * @param os: output stream
+     */
+    void report(std::ostream& os);
+
+    /**
+     * Turns profiling on, a trace already being recorded is written first
+     * @brief record Chrome trace events
+     * @param path: file written when tracing stops or the program exits
+     */
+    void trace(const std::string& path);
+    /**
+     * @brief write recorded trace events and stop recording
+     * @throw std::runtime_error: if the file cannot be written
+     */
+    void stopTrace();
+}
@@ -0,0 +1,35 @@
+/**
+ * @file text.hxx
+ * @author morozan1
+ * @brief Parallel loader of text matrix files
+ */
+#pragma once
+#include "matrix.hxx"
+/**
+ * @brief Text matrix files, one row per line, elements separated by whitespace
+ *
+ * The file is mapped and split into blocks of whole lines, every block is handled by its own task.
+ * A first pass counts rows and elements which are not written as zero, so the matrix is allocated
+ * once in its final form: rows are parsed straight into contiguous Storage, or into compressed rows
+ * if the matrix is sparse, without ever materializing its dense form. Blank lines are skipped.
+ */
+namespace text {
+    /**
+     * @brief size of a loaded file and time it took to load it
+     */
+    struct Throughput {
+        size_t bytes = 0;   ///< size of the file
+        double seconds = 0; ///< wall time of the load
+
+        double megabytesPerSecond() const; ///< bytes per second in MB
+    };
+
+    /**
+     * @brief load a text matrix file
+     * @param path: path to the file
+     * @param throughput: filled with size of the file and duration of the load
+     * @throw std::runtime_error: if the file cannot be read, rows have different sizes or an element is not a number
+     * @return std::shared_ptr<Matrix>: loaded matrix
+     */
+    std::shared_ptr<Matrix> load(const std::string& path, Throughput& throughput);
+}
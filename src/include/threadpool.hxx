@@ -0,0 +1,93 @@
+/**
+ * @file threadpool.hxx
+ * @author morozan1
+ * @brief Process-wide work-stealing thread pool for dense kernels
+ */
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+/**
+ * @brief Work-stealing thread pool shared by all matrix operations
+ *
+ * Every worker owns a task queue, it takes tasks from the back of its own queue and steals
+ * from the front of the others. A thread waiting for its parallelFor runs queued tasks too,
+ * so nested parallel loops cannot deadlock.
+ */
+class ThreadPool {
+public:
+    /**
+     * Pool is created on first use with MTRX_THREADS threads,
+     * or with one thread per hardware core if the variable is not set
+     * @brief the process-wide pool
+     * @return ThreadPool&: reference to the pool
+     */
+    static ThreadPool& instance();
+
+    ~ThreadPool(); ///< stops and joins the workers
+
+    /**
+     * @brief largest number of threads a pool may have, four per hardware core
+     * @return size_t: number of threads
+     */
+    static size_t maxThreads();
+
+    /**
+     * Must not be called while a parallelFor is running
+     * @brief change number of threads
+     * @param threads: number of threads including the calling one, at least 1
+     * @throw std::invalid_argument: if threads is 0 or more than maxThreads()
+     */
+    void resize(size_t threads);
+
+    /**
+     * @brief number of threads including the calling one
+     * @return size_t: number of threads
+     */
+    size_t size() const;
+
+    /**
+     * Splits [begin, end) into chunks of at least grain indices and runs body on them in parallel,
+     * ranges not longer than grain run serially on the calling thread.
+     * The first exception thrown by body is rethrown after all chunks finished.
+     * @brief parallel loop over a range
+     * @param begin: first index
+     * @param end: one past the last index
+     * @param grain: minimal number of indices per chunk
+     * @param body: function called with a subrange [lo, hi)
+     */
+    void parallelFor(size_t begin, size_t end, size_t grain, const std::function<void(size_t, size_t)>& body);
+
+private:
+    typedef std::function<void()> Task;
+
+    /**
+     * @brief queue owned by one worker
+     */
+    struct Queue {
+        std::mutex lock;         ///< guards tasks
+        std::deque<Task> tasks;  ///< pending tasks
+    };
+
+    std::vector<std::unique_ptr<Queue>> m_queues; ///< one queue per worker
+    std::vector<std::thread> m_workers; ///< worker threads
+    std::mutex m_sleepLock; ///< guards sleeping of idle workers
+    std::condition_variable m_wake; ///< wakes idle workers
+    std::atomic<size_t> m_pending; ///< number of queued tasks
+    std::atomic<size_t> m_next; ///< round robin queue for tasks pushed by non-worker threads
+    bool m_stop; ///< workers should exit
+
+    ThreadPool(size_t threads); ///< starts threads - 1 workers
+
+    void start(size_t workers); ///< spawns workers
+    void stop(); ///< joins workers
+    void work(size_t index); ///< worker loop
+    void push(Task task); ///< queues a task
+    bool runOne(); ///< runs one queued task if there is any, returns false otherwise
+};
@@ -0,0 +1,283 @@
+#include "../include/kernels.hxx"
+#include "../include/profile.hxx"
+#include "../include/threadpool.hxx"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <immintrin.h>
+
+using namespace std;
+
+// INFO: blocked GEMM
+// Loop order follows the usual five loop scheme: NC wide panels of B are packed once per KC deep
+// slice, MC tall panels of A are packed per slice and the micro-kernel multiplies MR x KC slivers
+// of A with KC x NR slivers of B into an MR x NR register tile.
+
+namespace {
+    const size_t MC = 72;    // rows of a packed A panel, multiple of every MR, fits L2
+    const size_t KC = 256;   // depth of packed panels, an A and a B sliver fit L1
+    const size_t NC = 4080;  // columns of a packed B panel, multiple of every NR
+    const double PARALLEL_WORK = 1 << 21; // multiply-adds below which gemm stays serial
+    const size_t MAX_MR = 6;
+    const size_t MAX_NR = 16;
+
+    typedef void (*KernelFn)(size_t kc, const double* a, const double* b, double* tile);
+
+    struct MicroKernel {
+        const char* name;
+        size_t mr;
+        size_t nr;
+        KernelFn run;
+    };
+
+    // portable fallback, 4 x 4 tile
+    void kernelScalar(size_t kc, const double* a, const double* b, double* tile) {
+        double c[4][4] = {};
+        for (size_t p = 0; p < kc; p++) {
+            for (size_t i = 0; i < 4; i++)
+                for (size_t j = 0; j < 4; j++)
+                    c[i][j] += a[i] * b[j];
+            a += 4;
+            b += 4;
+        }
+        for (size_t i = 0; i < 4; i++)
+            for (size_t j = 0; j < 4; j++)
+                tile[i * 4 + j] = c[i][j];
+    }
+
+#define ROW_FMA(fma, set1, i) \
+    { auto ai = set1(a[i]); c##i##0 = fma(ai, b0, c##i##0); c##i##1 = fma(ai, b1, c##i##1); }
+
+    // 6 x 8 tile in 12 ymm accumulators
+    __attribute__((target("avx2,fma")))
+    void kernelAvx2(size_t kc, const double* a, const double* b, double* tile) {
+        __m256d c00 = _mm256_setzero_pd(), c01 = c00, c10 = c00, c11 = c00, c20 = c00, c21 = c00,
+                c30 = c00, c31 = c00, c40 = c00, c41 = c00, c50 = c00, c51 = c00;
+        for (size_t p = 0; p < kc; p++) {
+            __m256d b0 = _mm256_load_pd(b), b1 = _mm256_load_pd(b + 4);
+            ROW_FMA(_mm256_fmadd_pd, _mm256_set1_pd, 0)
+            ROW_FMA(_mm256_fmadd_pd, _mm256_set1_pd, 1)
+            ROW_FMA(_mm256_fmadd_pd, _mm256_set1_pd, 2)
+            ROW_FMA(_mm256_fmadd_pd, _mm256_set1_pd, 3)
+            ROW_FMA(_mm256_fmadd_pd, _mm256_set1_pd, 4)
+            ROW_FMA(_mm256_fmadd_pd, _mm256_set1_pd, 5)
+            a += 6;
+            b += 8;
+        }
+        _mm256_store_pd(tile +  0, c00); _mm256_store_pd(tile +  4, c01);
+        _mm256_store_pd(tile +  8, c10); _mm256_store_pd(tile + 12, c11);
+        _mm256_store_pd(tile + 16, c20); _mm256_store_pd(tile + 20, c21);
+        _mm256_store_pd(tile + 24, c30); _mm256_store_pd(tile + 28, c31);
+        _mm256_store_pd(tile + 32, c40); _mm256_store_pd(tile + 36, c41);
+        _mm256_store_pd(tile + 40, c50); _mm256_store_pd(tile + 44, c51);
+    }
+
+    // 6 x 16 tile in 12 zmm accumulators
+    __attribute__((target("avx512f")))
+    void kernelAvx512(size_t kc, const double* a, const double* b, double* tile) {
+        __m512d c00 = _mm512_setzero_pd(), c01 = c00, c10 = c00, c11 = c00, c20 = c00, c21 = c00,
+                c30 = c00, c31 = c00, c40 = c00, c41 = c00, c50 = c00, c51 = c00;
+        for (size_t p = 0; p < kc; p++) {
+            __m512d b0 = _mm512_load_pd(b), b1 = _mm512_load_pd(b + 8);
+            ROW_FMA(_mm512_fmadd_pd, _mm512_set1_pd, 0)
+            ROW_FMA(_mm512_fmadd_pd, _mm512_set1_pd, 1)
+            ROW_FMA(_mm512_fmadd_pd, _mm512_set1_pd, 2)
+            ROW_FMA(_mm512_fmadd_pd, _mm512_set1_pd, 3)
+            ROW_FMA(_mm512_fmadd_pd, _mm512_set1_pd, 4)
+            ROW_FMA(_mm512_fmadd_pd, _mm512_set1_pd, 5)
+            a += 6;
+            b += 16;
+        }
+        _mm512_store_pd(tile +  0, c00); _mm512_store_pd(tile +  8, c01);
+        _mm512_store_pd(tile + 16, c10); _mm512_store_pd(tile + 24, c11);
+        _mm512_store_pd(tile + 32, c20); _mm512_store_pd(tile + 40, c21);
+        _mm512_store_pd(tile + 48, c30); _mm512_store_pd(tile + 56, c31);
+        _mm512_store_pd(tile + 64, c40); _mm512_store_pd(tile + 72, c41);
+        _mm512_store_pd(tile + 80, c50); _mm512_store_pd(tile + 88, c51);
+    }
+
+#undef ROW_FMA
+
+    const MicroKernel SCALAR = { "scalar", 4, 4, kernelScalar };
+    const MicroKernel AVX2 = { "avx2", 6, 8, kernelAvx2 };
+    const MicroKernel AVX512 = { "avx512", 6, 16, kernelAvx512 };
+
+    const MicroKernel& detectKernel() {
+        __builtin_cpu_init();
+        bool avx512 = __builtin_cpu_supports("avx512f");
+        bool avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+        const char* forced = getenv("MTRX_GEMM");
+        if (forced != nullptr) {
+            if (strcmp(forced, "scalar") == 0)
+                return SCALAR;
+            if (strcmp(forced, "avx2") == 0 && avx2)
+                return AVX2;
+        }
+        if (avx512)
+            return AVX512;
+        if (avx2)
+            return AVX2;
+        return SCALAR;
+    }
+
+    const MicroKernel& microKernel() {
+        static const MicroKernel& kernel = detectKernel();
+        return kernel;
+    }
+
+    // 64-byte aligned scratch reused by all calls made from one thread
+    struct PackBuffer {
+        double* data = nullptr;
+        size_t capacity = 0;
+        bool busy = false; // a caller waiting for its workers may start another gemm on this thread
+
+        ~PackBuffer() {
+            ::operator delete(data, align_val_t(64));
+        }
+
+        double* reserve(size_t size) {
+            if (size > capacity) {
+                ::operator delete(data, align_val_t(64));
+                data = static_cast<double*>(::operator new(size * sizeof(double), align_val_t(64)));
+                capacity = size;
+            }
+            return data;
+        }
+    };
+
+    thread_local PackBuffer packedA, packedB;
+
+    // mc x kc block of A into slivers of mr rows, each sliver stored column by column, floats are widened
+    template <typename T>
+    void packA(size_t mc, size_t kc, const T* a, size_t rsa, size_t csa, size_t mr, double* out) {
+        for (size_t ir = 0; ir < mc; ir += mr) {
+            size_t rows = min(mr, mc - ir);
+            for (size_t p = 0; p < kc; p++) {
+                const T* src = a + ir * rsa + p * csa;
+                for (size_t i = 0; i < rows; i++)
+                    out[i] = src[i * rsa];
+                for (size_t i = rows; i < mr; i++)
+                    out[i] = 0;
+                out += mr;
+            }
+        }
+    }
+
+    // cols elements of src that are csb apart into out, contiguous doubles are copied as they are
+    template <typename T>
+    void gather(const T* src, size_t csb, size_t cols, double* out) {
+        if constexpr (is_same_v<T, double>) {
+            if (csb == 1) {
+                memcpy(out, src, cols * sizeof(double));
+                return;
+            }
+        }
+        for (size_t j = 0; j < cols; j++)
+            out[j] = src[j * csb];
+    }
+
+    // kc x nc block of B into slivers of nr columns, each sliver stored row by row, floats are widened
+    template <typename T>
+    void packB(size_t kc, size_t nc, const T* b, size_t rsb, size_t csb, size_t nr, double* out) {
+        for (size_t jr = 0; jr < nc; jr += nr) {
+            size_t cols = min(nr, nc - jr);
+            for (size_t p = 0; p < kc; p++) {
+                const T* src = b + p * rsb + jr * csb;
+                gather(src, csb, cols, out);
+                for (size_t j = cols; j < nr; j++)
+                    out[j] = 0;
+                out += nr;
+            }
+        }
+    }
+
+    // packed mc x kc panel of A times packed kc x nc panel of B added to C
+    void macroKernel(const MicroKernel& kernel, size_t mc, size_t nc, size_t kc, double alpha,
+                     const double* ap, const double* bp, double* c, size_t ldc) {
+        alignas(64) double tile[MAX_MR * MAX_NR];
+        for (size_t jr = 0; jr < nc; jr += kernel.nr) {
+            size_t cols = min(kernel.nr, nc - jr);
+            for (size_t ir = 0; ir < mc; ir += kernel.mr) {
+                size_t rows = min(kernel.mr, mc - ir);
+                kernel.run(kc, ap + ir * kc, bp + jr * kc, tile);
+                double* target = c + ir * ldc + jr;
+                for (size_t i = 0; i < rows; i++)
+                    for (size_t j = 0; j < cols; j++)
+                        target[i * ldc + j] += alpha * tile[i * kernel.nr + j];
+            }
+        }
+    }
+}
+
+template <typename TA, typename TB>
+void kernels::gemm(size_t m, size_t n, size_t k, double alpha,
+                   const TA* a, size_t rsa, size_t csa,
+                   const TB* b, size_t rsb, size_t csb,
+                   double beta, double* c, size_t ldc) {
+    if (m == 0 || n == 0)
+        return;
+    static profile::Site site("gemm");
+    profile::Scope scope(&site, 2.0 * m * n * k);
+    if (beta == 0)
+        for (size_t i = 0; i < m; i++)
+            fill(c + i * ldc, c + i * ldc + n, 0.0);
+    else if (beta != 1)
+        for (size_t i = 0; i < m; i++)
+            for (size_t j = 0; j < n; j++)
+                c[i * ldc + j] *= beta;
+    if (k == 0 || alpha == 0)
+        return;
+
+    const MicroKernel& kernel = microKernel();
+    ThreadPool& pool = ThreadPool::instance();
+    bool parallel = pool.size() > 1 && double(m) * n * k >= PARALLEL_WORK;
+    size_t ncMax = min(NC, (n + kernel.nr - 1) / kernel.nr * kernel.nr);
+    PackBuffer nested;
+    PackBuffer& bBuffer = packedB.busy ? nested : packedB;
+    double* bp = bBuffer.reserve(KC * ncMax);
+    bBuffer.busy = true;
+    size_t blocks = (m + MC - 1) / MC;
+
+    for (size_t jc = 0; jc < n; jc += NC) {
+        size_t nc = min(NC, n - jc);
+        size_t slivers = (nc + kernel.nr - 1) / kernel.nr;
+        // too few row blocks for all threads, split the columns of the B panel as well
+        size_t parts = parallel ? min(slivers, max<size_t>(1, 2 * pool.size() / blocks)) : 1;
+        size_t perPart = (slivers + parts - 1) / parts;
+        parts = (slivers + perPart - 1) / perPart;
+        for (size_t pc = 0; pc < k; pc += KC) {
+            size_t kc = min(KC, k - pc);
+            pool.parallelFor(0, slivers, parallel ? 1 : slivers, [&](size_t lo, size_t hi) {
+                size_t first = lo * kernel.nr, last = min(nc, hi * kernel.nr);
+                packB(kc, last - first, b + pc * rsb + (jc + first) * csb, rsb, csb, kernel.nr, bp + first * kc);
+            });
+            pool.parallelFor(0, blocks * parts, parallel ? 1 : blocks * parts, [&](size_t lo, size_t hi) {
+                double* ap = packedA.reserve(KC * MC);
+                size_t packed = blocks;
+                for (size_t t = lo; t < hi; t++) {
+                    size_t block = t / parts, part = t % parts;
+                    size_t ic = block * MC, mc = min(MC, m - ic);
+                    if (packed != block) {
+                        packA(mc, kc, a + ic * rsa + pc * csa, rsa, csa, kernel.mr, ap);
+                        packed = block;
+                    }
+                    size_t first = part * perPart * kernel.nr, last = min(nc, (part + 1) * perPart * kernel.nr);
+                    macroKernel(kernel, mc, last - first, kc, alpha, ap, bp + first * kc,
+                                c + ic * ldc + jc + first, ldc);
+                }
+            });
+        }
+    }
+    bBuffer.busy = false;
+}
+
+template void kernels::gemm(size_t, size_t, size_t, double, const double*, size_t, size_t, const double*, size_t, size_t, double, double*, size_t);
+template void kernels::gemm(size_t, size_t, size_t, double, const float*, size_t, size_t, const float*, size_t, size_t, double, double*, size_t);
+template void kernels::gemm(size_t, size_t, size_t, double, const float*, size_t, size_t, const double*, size_t, size_t, double, double*, size_t);
+template void kernels::gemm(size_t, size_t, size_t, double, const double*, size_t, size_t, const float*, size_t, size_t, double, double*, size_t);
+
+string kernels::gemmKernel() {
+    return microKernel().name;
+}
@@ -0,0 +1,33 @@
+#include "../include/kernels.hxx"
+#include "../include/threadpool.hxx"
+#include <algorithm>
+#include <vector>
+
+using namespace std;
+
+// INFO: product of upper triangular matrices
+// Block (I, J) of the result is the sum of A(I, K) * B(K, J) for I <= K <= J, every other
+// block of A or B in that sum is zero. Blocks of the result are independent of each other.
+
+namespace {
+    const size_t NB = 256; // side of a block, large enough for gemm to reach its peak
+}
+
+void kernels::upperGemm(size_t n, const double* a, size_t lda, const double* b, size_t ldb, double* c, size_t ldc) {
+    size_t blocks = (n + NB - 1) / NB;
+    vector<pair<size_t, size_t>> targets;
+    for (size_t bi = 0; bi < blocks; bi++)
+        for (size_t bj = bi; bj < blocks; bj++)
+            targets.push_back(make_pair(bi, bj));
+    ThreadPool::instance().parallelFor(0, targets.size(), 1, [&](size_t lo, size_t hi) {
+        for (size_t t = lo; t < hi; t++) {
+            size_t i = targets[t].first * NB, j = targets[t].second * NB;
+            size_t mb = min(NB, n - i), nb = min(NB, n - j);
+            double* target = c + i * ldc + j;
+            for (size_t r = 0; r < mb; r++)
+                fill(target + r * ldc, target + r * ldc + nb, 0.0);
+            for (size_t k = i; k <= j; k += NB)
+                gemm(mb, nb, min(NB, n - k), 1, a + i * lda + k, lda, 1, b + k * ldb + j, ldb, 1, 1, target, ldc);
+        }
+    });
+}
@@ -1,8 +1,9 @@
 #include "include/parser.hxx"
+#include <charconv>
 
 using namespace std;
 
-const string single_char_tokens = "+-*/^()[]!|&=";
+const string_view single_char_tokens = "+-*/^()[]!|&=";
 
 // Implementation of Lexer
 // Constructor
@@ -12,36 +13,43 @@ Lexer::Lexer(istream &is) : m_is(is), m_pos(0) {}
 void Lexer::getInput() {
     getline(m_is, m_input);
     m_pos = 0;
+    m_token = Token();
+    m_next = nextToken();
 }
-string Lexer::getCurrentToken() const { return m_token; }
-string Lexer::peekToken() {
-    size_t pos = m_pos;
-    string token = nextToken();
-    m_pos = pos;
-    return token;
+const Token& Lexer::current() const { return m_token; }
+string_view Lexer::getCurrentToken() const { return m_token.text; }
+string_view Lexer::peekToken() const { return m_next.text; }
+string_view Lexer::getNextToken() {
+    m_token = m_next;
+    m_next = nextToken();
+    return m_token.text;
 }
-string Lexer::getNextToken() {
-    m_token = nextToken();
-    return m_token;
+string_view Lexer::rest() const {
+    if (m_token.kind == TokenKind::END)
+        return string_view();
+    return string_view(m_input).substr(m_token.text.data() - m_input.data());
 }
 
 // Private methods
-string Lexer::nextToken() {
-    if (m_pos >= m_input.size()) {
-        return "";
-    }
-    while (m_input[m_pos] == ' ') {
+Token Lexer::nextToken() {
+    Token token;
+    while (m_pos < m_input.size() && isspace(static_cast<unsigned char>(m_input[m_pos])))
         m_pos++;
-        if (m_pos >= m_input.size()) {
-            return "";
-        }
-    }
-    if (single_char_tokens.find(m_input[m_pos]) != string::npos) {
-        return string(1, m_input[m_pos++]);
-    }
-    string token = "";
-    while (m_pos < m_input.size() && !isspace(m_input[m_pos]) && single_char_tokens.find(m_input[m_pos]) == string::npos) {
-        token += m_input[m_pos++];
+    if (m_pos >= m_input.size())
+        return token;
+    size_t start = m_pos;
+    if (single_char_tokens.find(m_input[m_pos]) != string_view::npos) {
+        token.kind = TokenKind::OPERATOR;
+        token.text = string_view(m_input).substr(start, 1);
+        m_pos++;
+        return token;
     }
+    while (m_pos < m_input.size() && !isspace(static_cast<unsigned char>(m_input[m_pos])) && single_char_tokens.find(m_input[m_pos]) == string_view::npos)
+        m_pos++;
+    token.text = string_view(m_input).substr(start, m_pos - start);
+    // a token is a number only if all of it is read as one
+    const char* end = token.text.data() + token.text.size();
+    auto result = from_chars(token.text.data(), end, token.number);
+    token.kind = result.ec == errc() && result.ptr == end ? TokenKind::NUMBER : TokenKind::IDENTIFIER;
     return token;
 }
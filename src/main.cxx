@@ -2,7 +2,8 @@
 
 using namespace std;
 
-int main ( void ) {
+// morozan1 starts the REPL, morozan1 SCRIPT runs a script in batch mode, morozan1 - reads it from stdin
+int main ( int argc, char* argv[] ) {
     string saveDir = "examples";
     try{
         fstream file("examples/config.txt");
@@ -13,6 +14,17 @@ int main ( void ) {
         cout << e.what() << endl;
         cout << "Using default directory: " << saveDir << endl;
     }
+    if (argc > 1) {
+        string script = argv[1];
+        if (script == "-")
+            return Parser(saveDir).runScript();
+        ifstream file(script);
+        if (!file) {
+            cerr << "Cannot open script '" << script << "'" << endl;
+            return 1;
+        }
+        return Parser(saveDir, cout, file).runScript();
+    }
     Parser repl = Parser(saveDir);
     repl.run();
     return 0;
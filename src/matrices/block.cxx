@@ -0,0 +1,209 @@
+#include "../include/matrix.hxx"
+#include "../include/lu.hxx"
+#include "../include/profile.hxx"
+#include <algorithm>
+
+using namespace std;
+
+// INFO: BlockMatrix class implementation
+
+namespace {
+    // a block matrix as its grid, any other matrix as a grid of one block
+    BlockMatrix::Grid grid(const shared_ptr<Matrix>& m) {
+        if (m->isBlock())
+            return static_cast<const BlockMatrix&>(*m).blocks();
+        return BlockMatrix::Grid{{m}};
+    }
+
+    vector<size_t> heights(const BlockMatrix::Grid& blocks) {
+        vector<size_t> result;
+        for (const auto& row : blocks)
+            result.push_back(row.front()->rows());
+        return result;
+    }
+
+    vector<size_t> widths(const BlockMatrix::Grid& blocks) {
+        vector<size_t> result;
+        for (const auto& block : blocks.front())
+            result.push_back(block->cols());
+        return result;
+    }
+
+    // first index of every part followed by the total
+    vector<size_t> starts(const vector<size_t>& sizes) {
+        vector<size_t> result(1, 0);
+        for (size_t size : sizes)
+            result.push_back(result.back() + size);
+        return result;
+    }
+
+    // index of the part containing index
+    size_t part(const vector<size_t>& start, size_t index) {
+        return upper_bound(start.begin(), start.end(), index) - start.begin() - 1;
+    }
+
+    // adds all elements of m to out starting at (top, left)
+    void accumulate(const Matrix& m, Storage& out, size_t top, size_t left) {
+        vector<double> buffer(m.cols());
+        for (size_t i = 0; i < m.rows(); i++) {
+            const double* src = m.readRow(i, buffer.data());
+            double* dst = out.row(top + i) + left;
+            for (size_t j = 0; j < m.cols(); j++)
+                dst[j] += src[j];
+        }
+    }
+}
+
+BlockMatrix::BlockMatrix(Grid blocks)   :   Matrix()
+                                        ,   m_blocks(move(blocks)) {
+    m_rowStart = starts(heights(m_blocks));
+    m_colStart = starts(widths(m_blocks));
+    m_empty = false;
+}
+
+BlockMatrix::BlockMatrix(const BlockMatrix& m)  :   Matrix(m)
+                                                ,   m_blocks(m.m_blocks)
+                                                ,   m_rowStart(m.m_rowStart)
+                                                ,   m_colStart(m.m_colStart) {}
+
+shared_ptr<Matrix> BlockMatrix::hconcat(shared_ptr<Matrix> lhs, shared_ptr<Matrix> rhs) {
+    if (lhs->rows() != rhs->rows())
+        throw runtime_error("Different number of rows");
+    if (lhs->rows() * (lhs->cols() + rhs->cols()) < MIN_ELEMENTS || (lhs->isSparse() && rhs->isSparse()))
+        return lhs->hconcat(rhs);
+    Grid left = grid(lhs), right = grid(rhs);
+    if (heights(left) != heights(right))
+        left = Grid{{lhs}}, right = Grid{{rhs}};
+    for (size_t i = 0; i < left.size(); i++)
+        left[i].insert(left[i].end(), right[i].begin(), right[i].end());
+    return make_shared<BlockMatrix>(move(left));
+}
+
+shared_ptr<Matrix> BlockMatrix::vconcat(shared_ptr<Matrix> lhs, shared_ptr<Matrix> rhs) {
+    if (lhs->cols() != rhs->cols())
+        throw runtime_error("Different number of columns");
+    if ((lhs->rows() + rhs->rows()) * lhs->cols() < MIN_ELEMENTS || (lhs->isSparse() && rhs->isSparse()))
+        return lhs->vconcat(rhs);
+    Grid top = grid(lhs), bottom = grid(rhs);
+    if (widths(top) != widths(bottom))
+        top = Grid{{lhs}}, bottom = Grid{{rhs}};
+    top.insert(top.end(), bottom.begin(), bottom.end());
+    return make_shared<BlockMatrix>(move(top));
+}
+
+size_t BlockMatrix::rows() const {
+    return m_rowStart.back();
+}
+
+size_t BlockMatrix::cols() const {
+    return m_colStart.back();
+}
+
+shared_ptr<Matrix> BlockMatrix::transform() {
+    static profile::Site site("transform");
+    profile::Scope scope(&site);
+    return classify(dense());
+}
+
+bool BlockMatrix::isBlock() const {
+    return true;
+}
+
+const BlockMatrix::Grid& BlockMatrix::blocks() const {
+    return m_blocks;
+}
+
+bool BlockMatrix::isDenseStored() const {
+    return false;
+}
+
+void BlockMatrix::copyRows(size_t first, size_t last, double* out, size_t ld) const {
+    for (size_t i = part(m_rowStart, first); i < m_blocks.size() && m_rowStart[i] < last; i++) {
+        size_t lo = max(first, m_rowStart[i]), hi = min(last, m_rowStart[i + 1]);
+        for (size_t j = 0; j < m_blocks[i].size(); j++)
+            m_blocks[i][j]->copyRows(lo - m_rowStart[i], hi - m_rowStart[i], out + (lo - first) * ld + m_colStart[j], ld);
+    }
+}
+
+double BlockMatrix::get(size_t row, size_t col) const {
+    if (row >= rows())
+        throw runtime_error("Row index out of range");
+    if (col >= cols())
+        throw runtime_error("Column index out of range");
+    size_t i = part(m_rowStart, row), j = part(m_colStart, col);
+    return m_blocks[i][j]->get(row - m_rowStart[i], col - m_colStart[j]);
+}
+
+shared_ptr<Matrix> BlockMatrix::prod(const shared_ptr<Matrix> rhs) const {
+    if (rhs->isNumber()) {
+        Grid result = m_blocks;
+        for (auto& row : result)
+            for (auto& block : row)
+                block = block->prod(rhs);
+        return make_shared<BlockMatrix>(move(result));
+    }
+    if (cols() != rhs->rows())
+        throw runtime_error("Different number of colum");
+    // rows of rhs are split like columns of this matrix, a block rhs split that way keeps its columns split too
+    Grid right;
+    Storage data;
+    if (rhs->isBlock() && starts(heights(grid(rhs))) == m_colStart) {
+        right = grid(rhs);
+    } else {
+        data = rhs->dense();
+        for (size_t k = 0; k + 1 < m_colStart.size(); k++)
+            right.push_back({make_shared<ViewMatrix>(data, m_colStart[k] * data.stride(), m_colStart[k + 1] - m_colStart[k],
+                                                     rhs->cols(), data.stride(), 1)});
+    }
+    vector<size_t> rightStart = starts(widths(right));
+    vector<vector<bool>> leftZero(m_blocks.size()), rightZero(right.size());
+    for (size_t i = 0; i < m_blocks.size(); i++)
+        for (const auto& block : m_blocks[i])
+            leftZero[i].push_back(block->isZero());
+    for (size_t k = 0; k < right.size(); k++)
+        for (const auto& block : right[k])
+            rightZero[k].push_back(block->isZero());
+
+    Storage result = Storage::zeros(rows(), rhs->cols());
+    for (size_t i = 0; i < m_blocks.size(); i++)
+        for (size_t j = 0; j + 1 < rightStart.size(); j++)
+            for (size_t k = 0; k < right.size(); k++)
+                if (!leftZero[i][k] && !rightZero[k][j])
+                    accumulate(*m_blocks[i][k]->prod(right[k][j]), result, m_rowStart[i], rightStart[j]);
+    return classify(result);
+}
+
+shared_ptr<Matrix> BlockMatrix::power(const shared_ptr<Matrix> rhs) const {
+    if (!isSquare())
+        return Matrix::power(rhs);
+    return SquareMatrix(dense()).power(rhs);
+}
+
+shared_ptr<Matrix> BlockMatrix::transpose() const {
+    Grid result(m_blocks.front().size(), vector<shared_ptr<Matrix>>(m_blocks.size()));
+    for (size_t i = 0; i < m_blocks.size(); i++)
+        for (size_t j = 0; j < m_blocks[i].size(); j++)
+            result[j][i] = m_blocks[i][j]->transpose();
+    return make_shared<BlockMatrix>(move(result));
+}
+
+shared_ptr<Matrix> BlockMatrix::det() const {
+    if (!isSquare())
+        throw runtime_error("Non square matrix");
+    if (m_rowStart == m_colStart) {
+        // diagonal blocks are square, zeros on one side of them make the matrix block triangular
+        bool upper = true, lower = true;
+        for (size_t i = 0; i < m_blocks.size() && (upper || lower); i++)
+            for (size_t j = 0; j < i && (upper || lower); j++) {
+                upper = upper && m_blocks[i][j]->isZero();
+                lower = lower && m_blocks[j][i]->isZero();
+            }
+        if (upper || lower) {
+            double result = 1;
+            for (size_t i = 0; i < m_blocks.size(); i++)
+                result *= m_blocks[i][i]->det()->number();
+            return make_shared<Number>(result);
+        }
+    }
+    return make_shared<Number>(factorization()->det());
+}
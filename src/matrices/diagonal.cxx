@@ -1,4 +1,5 @@
 #include "../include/matrix.hxx"
+#include <algorithm>
 
 using namespace std;
 
@@ -7,21 +8,41 @@ using namespace std;
 DiagonalMatrix::DiagonalMatrix() : TriangularMatrix() {}
 
 DiagonalMatrix::DiagonalMatrix(const DiagonalMatrix& matrix) : TriangularMatrix() {
-    m_data.resize(1, vector<double>(matrix.rows()));
-    for (size_t i = 0; i < matrix.rows(); i++)
-        m_data[0][i] = matrix.get(i, i);
+    if (matrix.m_data.empty()) {
+        m_data = Storage(1, matrix.rows());
+        for (size_t i = 0; i < matrix.rows(); i++)
+            m_data(0, i) = matrix.get(i, i);
+    }
+    else
+        m_data = matrix.m_data;
     m_size = matrix.rows();
     m_empty = false;
 }
 
 DiagonalMatrix::DiagonalMatrix(const TriangularMatrix& matrix) : TriangularMatrix() {
-    m_data.resize(1, vector<double>(matrix.rows()));
+    m_data = Storage(1, matrix.rows());
     for (size_t i = 0; i < matrix.rows(); i++)
-        m_data[0][i] = matrix.get(i, i);
+        m_data(0, i) = matrix.get(i, i);
     m_size = matrix.rows();
     m_empty = false;
 }
 
+DiagonalMatrix::DiagonalMatrix(const Storage& data) : TriangularMatrix() {
+    m_data = Storage(1, data.rows());
+    for (size_t i = 0; i < data.rows(); i++)
+        m_data(0, i) = data(i, i);
+    m_size = data.rows();
+    m_empty = false;
+}
+
+DiagonalMatrix::DiagonalMatrix(size_t size, Storage diagonal) : TriangularMatrix() {
+    if (diagonal.rows() != 1 || diagonal.cols() != size)
+        throw runtime_error("Diagonal has wrong size");
+    m_data = diagonal;
+    m_size = size;
+    m_empty = false;
+}
+
 shared_ptr<Matrix> DiagonalMatrix::transform() {
     if (this->isIdentity()) {
         shared_ptr<Matrix> m = make_shared<IdentityMatrix>(this->rows());
@@ -34,13 +55,32 @@ bool DiagonalMatrix::isDiagonal() const {
     return true;
 }
 
+Structure DiagonalMatrix::structure() const {
+    return Structure::DIAGONAL;
+}
+
+Layout DiagonalMatrix::layout() const {
+    return Layout::DIAGONAL;
+}
+
 bool DiagonalMatrix::isIdentity() const {
     for (size_t i = 0; i < rows(); i++)
-        if (this->get(i, i) != 1)
+        if (m_data(0, i) != 1)
             return false;
     return true;
 }
 
+bool DiagonalMatrix::isDenseStored() const {
+    return false;
+}
+
+void DiagonalMatrix::copyRows(size_t first, size_t last, double* out, size_t ld) const {
+    for (size_t i = first; i < last; i++, out += ld) {
+        fill(out, out + cols(), 0.0);
+        out[i] = m_data(0, i);
+    }
+}
+
 double DiagonalMatrix::get(size_t i, size_t j) const {
     if (i >= rows())
         throw runtime_error("Row index out of range");
@@ -48,5 +88,113 @@ double DiagonalMatrix::get(size_t i, size_t j) const {
         throw runtime_error("Column index out of range");
     if (i != j)
         return 0;
-    return m_data[0][i];
+    return m_data(0, i);
+}
+
+shared_ptr<Matrix> DiagonalMatrix::fromDiagonal(Storage diagonal) {
+    bool zero = true, identity = true;
+    for (size_t i = 0; i < diagonal.cols(); i++) {
+        zero = zero && diagonal(0, i) == 0;
+        identity = identity && diagonal(0, i) == 1;
+    }
+    if (zero)
+        return make_shared<ZeroMatrix>(diagonal.cols(), diagonal.cols());
+    if (identity)
+        return make_shared<IdentityMatrix>(diagonal.cols());
+    shared_ptr<DiagonalMatrix> m = make_shared<DiagonalMatrix>();
+    m->m_data = diagonal;
+    m->m_size = diagonal.cols();
+    m->m_empty = false;
+    return m;
+}
+
+shared_ptr<Matrix> DiagonalMatrix::add(const shared_ptr<Matrix> rhs) const {
+    if (rhs->structure() != Structure::DIAGONAL || rhs->rows() != rows())
+        return Matrix::add(rhs);
+    Storage result(1, rows());
+    for (size_t i = 0; i < rows(); i++)
+        result(0, i) = get(i, i) + rhs->get(i, i);
+    return fromDiagonal(result);
+}
+
+shared_ptr<Matrix> DiagonalMatrix::sub(const shared_ptr<Matrix> rhs) const {
+    if (rhs->structure() != Structure::DIAGONAL || rhs->rows() != rows())
+        return Matrix::sub(rhs);
+    Storage result(1, rows());
+    for (size_t i = 0; i < rows(); i++)
+        result(0, i) = get(i, i) - rhs->get(i, i);
+    return fromDiagonal(result);
+}
+
+shared_ptr<Matrix> DiagonalMatrix::prod(const shared_ptr<Matrix> rhs) const {
+    Storage result(1, rows());
+    if (rhs->isNumber()) {
+        double n = rhs->number();
+        for (size_t i = 0; i < rows(); i++)
+            result(0, i) = get(i, i) * n;
+        return fromDiagonal(result);
+    }
+    if (cols() != rhs->rows())
+        throw runtime_error("Different number of colum");
+    if (rhs->structure() == Structure::DIAGONAL) {
+        for (size_t i = 0; i < rows(); i++)
+            result(0, i) = get(i, i) * rhs->get(i, i);
+        return fromDiagonal(result);
+    }
+    // every row of rhs is scaled by one element of the diagonal
+    Storage data = rhs->dense();
+    result = Storage(rows(), rhs->cols());
+    for (size_t i = 0; i < rows(); i++) {
+        double scale = get(i, i);
+        const double* row = data.row(i);
+        double* out = result.row(i);
+        for (size_t j = 0; j < rhs->cols(); j++)
+            out[j] = row[j] * scale;
+    }
+    return classify(result, rhs->structure());
+}
+
+shared_ptr<Matrix> DiagonalMatrix::power(const shared_ptr<Matrix> rhs) const {
+    double n = exponent(rhs);
+    Storage result(1, rows());
+    for (size_t i = 0; i < rows(); i++)
+        result(0, i) = pow(get(i, i), n);
+    return fromDiagonal(result);
+}
+
+shared_ptr<Matrix> DiagonalMatrix::transpose() const {
+    return make_shared<DiagonalMatrix>(*this);
+}
+
+shared_ptr<Matrix> DiagonalMatrix::rank() const {
+    size_t rank = 0;
+    double negligible = tolerance();
+    for (size_t i = 0; i < rows(); i++)
+        if (fabs(get(i, i)) > negligible)
+            rank++;
+    return make_shared<Number>(rank);
+}
+
+shared_ptr<Matrix> DiagonalMatrix::gem() const {
+    double negligible = tolerance();
+    for (size_t i = 0; i < rows(); i++)
+        if (fabs(get(i, i)) <= negligible)
+            return Matrix::gem();
+    return make_shared<DiagonalMatrix>(*this);
+}
+
+shared_ptr<Matrix> DiagonalMatrix::inv() const {
+    Storage result(1, rows());
+    for (size_t i = 0; i < rows(); i++) {
+        if (get(i, i) == 0)
+            throw runtime_error("Singular matrix");
+        result(0, i) = 1 / get(i, i);
+    }
+    return fromDiagonal(result);
+}
+
+shared_ptr<Matrix> DiagonalMatrix::solve(const shared_ptr<Matrix> rhs) const {
+    if (rows() != rhs->rows())
+        throw runtime_error("Different number of rows");
+    return this->inv()->prod(rhs);
 }
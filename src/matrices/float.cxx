@@ -0,0 +1,271 @@
+#include "../include/matrix.hxx"
+#include "../include/kernels.hxx"
+#include "../include/lu.hxx"
+#include "../include/profile.hxx"
+#include "../include/threadpool.hxx"
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <new>
+
+using namespace std;
+
+// INFO: FloatMatrix class implementation
+
+namespace {
+    const size_t PARALLEL_ELEMENTS = 1 << 15; ///< elements per task, smaller matrices stay serial
+    const size_t TILE = 32; ///< a tile of source rows and one of result rows stay in L1
+
+    // runs body(lo, hi) over row ranges of [0, rows) on the thread pool
+    void forRows(size_t rows, size_t width, const function<void(size_t, size_t)>& body) {
+        ThreadPool::instance().parallelFor(0, rows, max<size_t>(1, PARALLEL_ELEMENTS / max<size_t>(1, width)), body);
+    }
+
+    shared_ptr<float> allocate(size_t count) {
+        if (count == 0)
+            return shared_ptr<float>();
+        void* p = ::operator new(count * sizeof(float), align_val_t(Storage::ALIGNMENT));
+        profile::allocated(count * sizeof(float));
+        memset(p, 0, count * sizeof(float));
+        return shared_ptr<float>(static_cast<float*>(p), [count](float* f) {
+            profile::released(count * sizeof(float));
+            ::operator delete(f, align_val_t(Storage::ALIGNMENT));
+        });
+    }
+
+    // rows x cols float matrix, row(i, out) writes row i of the result
+    shared_ptr<Matrix> build(size_t rows, size_t cols, const function<void(size_t, float*)>& row) {
+        size_t stride = FloatMatrix::paddedStride(cols);
+        shared_ptr<float> buffer = allocate(rows * stride);
+        forRows(rows, cols, [&](size_t lo, size_t hi) {
+            for (size_t i = lo; i < hi; i++)
+                row(i, buffer.get() + i * stride);
+        });
+        return make_shared<FloatMatrix>(buffer, rows, cols);
+    }
+
+    // double elements rounded once
+    shared_ptr<Matrix> round(const Storage& data) {
+        return build(data.rows(), data.cols(), [&](size_t i, float* out) {
+            const double* src = data.row(i);
+            for (size_t j = 0; j < data.cols(); j++)
+                out[j] = src[j];
+        });
+    }
+}
+
+FloatMatrix::FloatMatrix(shared_ptr<float> buffer, size_t rows, size_t cols)    :   Matrix()
+                                                                                ,   m_values(buffer)
+                                                                                ,   m_rows(rows)
+                                                                                ,   m_cols(cols)
+                                                                                ,   m_stride(paddedStride(cols)) {
+    m_empty = false;
+}
+
+FloatMatrix::FloatMatrix(const FloatMatrix& m)  :   Matrix(m)
+                                                ,   m_values(m.m_values)
+                                                ,   m_rows(m.m_rows)
+                                                ,   m_cols(m.m_cols)
+                                                ,   m_stride(m.m_stride) {}
+
+size_t FloatMatrix::paddedStride(size_t cols) {
+    if (cols < LANES)
+        return cols;
+    return (cols + LANES - 1) / LANES * LANES;
+}
+
+shared_ptr<Matrix> FloatMatrix::narrow(const shared_ptr<Matrix>& m) {
+    if (m->isFloat() || m->isEmpty() || m->isNumber() || m->layout() != Layout::DENSE)
+        return m;
+    return build(m->rows(), m->cols(), [&](size_t i, float* out) {
+        thread_local vector<double> buffer;
+        buffer.resize(m->cols());
+        const double* src = m->readRow(i, buffer.data());
+        for (size_t j = 0; j < m->cols(); j++)
+            out[j] = src[j];
+    });
+}
+
+shared_ptr<Matrix> FloatMatrix::widen(const shared_ptr<Matrix>& m) {
+    if (!m->isFloat())
+        return m;
+    return classify(m->dense());
+}
+
+shared_ptr<Matrix> FloatMatrix::multiply(const Matrix& lhs, const Matrix& rhs) {
+    if (lhs.cols() != rhs.rows())
+        throw runtime_error("Different number of colum");
+    // each operand is read in place as floats or doubles, anything else is materialized first
+    Storage lhsData, rhsData;
+    const float *af = nullptr, *bf = nullptr;
+    const double *ad = nullptr, *bd = nullptr;
+    size_t rsa = 0, csa = 1, rsb = 0, csb = 1;
+    if (lhs.isFloat()) {
+        af = static_cast<const FloatMatrix&>(lhs).values();
+        rsa = static_cast<const FloatMatrix&>(lhs).stride();
+    } else if (!lhs.strided(ad, rsa, csa)) {
+        lhsData = lhs.dense();
+        ad = lhsData.data(), rsa = lhsData.stride(), csa = 1;
+    }
+    if (rhs.isFloat()) {
+        bf = static_cast<const FloatMatrix&>(rhs).values();
+        rsb = static_cast<const FloatMatrix&>(rhs).stride();
+    } else if (!rhs.strided(bd, rsb, csb)) {
+        rhsData = rhs.dense();
+        bd = rhsData.data(), rsb = rhsData.stride(), csb = 1;
+    }
+    size_t m = lhs.rows(), n = rhs.cols(), k = lhs.cols();
+    Storage result(m, n);
+    if (af != nullptr && bf != nullptr)
+        kernels::gemm(m, n, k, 1, af, rsa, csa, bf, rsb, csb, 0, result.data(), result.stride());
+    else if (af != nullptr)
+        kernels::gemm(m, n, k, 1, af, rsa, csa, bd, rsb, csb, 0, result.data(), result.stride());
+    else if (bf != nullptr)
+        kernels::gemm(m, n, k, 1, ad, rsa, csa, bf, rsb, csb, 0, result.data(), result.stride());
+    else
+        kernels::gemm(m, n, k, 1, ad, rsa, csa, bd, rsb, csb, 0, result.data(), result.stride());
+    if (lhs.isFloat() && rhs.isFloat())
+        return round(result);
+    return classify(result);
+}
+
+size_t FloatMatrix::rows() const {
+    return m_rows;
+}
+
+size_t FloatMatrix::cols() const {
+    return m_cols;
+}
+
+shared_ptr<Matrix> FloatMatrix::transform() {
+    return make_shared<FloatMatrix>(*this);
+}
+
+bool FloatMatrix::isFloat() const {
+    return true;
+}
+
+const float* FloatMatrix::values() const {
+    return m_values.get();
+}
+
+size_t FloatMatrix::stride() const {
+    return m_stride;
+}
+
+bool FloatMatrix::isDenseStored() const {
+    return false;
+}
+
+void FloatMatrix::copyRows(size_t first, size_t last, double* out, size_t ld) const {
+    for (size_t i = first; i < last; i++, out += ld) {
+        const float* src = m_values.get() + i * m_stride;
+        for (size_t j = 0; j < m_cols; j++)
+            out[j] = src[j];
+    }
+}
+
+double FloatMatrix::get(size_t row, size_t col) const {
+    if (row >= rows())
+        throw runtime_error("Row index out of range");
+    if (col >= cols())
+        throw runtime_error("Column index out of range");
+    return m_values.get()[row * m_stride + col];
+}
+
+shared_ptr<Matrix> FloatMatrix::add(const shared_ptr<Matrix> rhs) const {
+    if (!rhs->isFloat())
+        return Matrix::add(rhs);
+    return narrow(Matrix::add(rhs));
+}
+
+shared_ptr<Matrix> FloatMatrix::neg() const {
+    return build(m_rows, m_cols, [&](size_t i, float* out) {
+        const float* src = m_values.get() + i * m_stride;
+        for (size_t j = 0; j < m_cols; j++)
+            out[j] = -src[j];
+    });
+}
+
+shared_ptr<Matrix> FloatMatrix::sub(const shared_ptr<Matrix> rhs) const {
+    if (!rhs->isFloat())
+        return Matrix::sub(rhs);
+    return narrow(Matrix::sub(rhs));
+}
+
+shared_ptr<Matrix> FloatMatrix::prod(const shared_ptr<Matrix> rhs) const {
+    if (rhs->isNumber()) {
+        double n = rhs->number();
+        return build(m_rows, m_cols, [&](size_t i, float* out) {
+            const float* src = m_values.get() + i * m_stride;
+            for (size_t j = 0; j < m_cols; j++)
+                out[j] = src[j] * n;
+        });
+    }
+    if (cols() != rhs->rows())
+        throw runtime_error("Different number of colum");
+    // diagonal and sparse matrices are cheaper to apply by their own rules
+    if (rhs->structure() == Structure::DIAGONAL || rhs->isSparse())
+        return Matrix::prod(rhs);
+    return multiply(*this, *rhs);
+}
+
+shared_ptr<Matrix> FloatMatrix::power(const shared_ptr<Matrix> rhs) const {
+    if (!isSquare())
+        return Matrix::power(rhs);
+    return narrow(SquareMatrix(dense()).power(rhs));
+}
+
+shared_ptr<Matrix> FloatMatrix::transpose() const {
+    shared_ptr<float> buffer = allocate(m_cols * paddedStride(m_rows));
+    size_t stride = paddedStride(m_rows), tiles = (m_cols + TILE - 1) / TILE;
+    ThreadPool::instance().parallelFor(0, tiles, max<size_t>(1, PARALLEL_ELEMENTS / (m_rows * TILE)), [&](size_t lo, size_t hi) {
+        for (size_t ib = lo * TILE; ib < min(m_cols, hi * TILE); ib += TILE)
+            for (size_t jb = 0; jb < m_rows; jb += TILE)
+                for (size_t j = jb; j < min(m_rows, jb + TILE); j++) {
+                    const float* src = m_values.get() + j * m_stride;
+                    for (size_t i = ib; i < min(m_cols, ib + TILE); i++)
+                        buffer.get()[i * stride + j] = src[i];
+                }
+    });
+    return make_shared<FloatMatrix>(buffer, m_cols, m_rows);
+}
+
+shared_ptr<Matrix> FloatMatrix::hconcat(const shared_ptr<Matrix> rhs) const {
+    if (!rhs->isFloat())
+        return Matrix::hconcat(rhs);
+    return narrow(Matrix::hconcat(rhs));
+}
+
+shared_ptr<Matrix> FloatMatrix::vconcat(const shared_ptr<Matrix> rhs) const {
+    if (!rhs->isFloat())
+        return Matrix::vconcat(rhs);
+    return narrow(Matrix::vconcat(rhs));
+}
+
+shared_ptr<Matrix> FloatMatrix::det() const {
+    if (!isSquare())
+        throw runtime_error("Non square matrix");
+    return make_shared<Number>(factorization()->det());
+}
+
+shared_ptr<Matrix> FloatMatrix::gem() const {
+    return narrow(Matrix::gem());
+}
+
+shared_ptr<Matrix> FloatMatrix::inv() const {
+    return narrow(Matrix::inv());
+}
+
+shared_ptr<Matrix> FloatMatrix::solve(const shared_ptr<Matrix> rhs) const {
+    if (!rhs->isFloat())
+        return Matrix::solve(rhs);
+    return narrow(Matrix::solve(rhs));
+}
+
+shared_ptr<Matrix> FloatMatrix::region(size_t top, size_t left, size_t rows, size_t cols) const {
+    return build(rows, cols, [&](size_t i, float* out) {
+        const float* src = m_values.get() + (top + i) * m_stride + left;
+        copy(src, src + cols, out);
+    });
+}
@@ -1,4 +1,5 @@
 #include "../include/matrix.hxx"
+#include <algorithm>
 
 using namespace std;
 
@@ -24,6 +25,17 @@ bool IdentityMatrix::isIdentity() const {
     return true;
 }
 
+Layout IdentityMatrix::layout() const {
+    return Layout::IDENTITY;
+}
+
+void IdentityMatrix::copyRows(size_t first, size_t last, double* out, size_t ld) const {
+    for (size_t i = first; i < last; i++, out += ld) {
+        fill(out, out + cols(), 0.0);
+        out[i] = 1;
+    }
+}
+
 double IdentityMatrix::get(size_t i, size_t j) const {
     if (i >= rows())
         throw runtime_error("Row index out of range");
@@ -33,3 +45,35 @@ double IdentityMatrix::get(size_t i, size_t j) const {
         return 0;
     return 1;
 }
+
+shared_ptr<Matrix> IdentityMatrix::prod(const shared_ptr<Matrix> rhs) const {
+    if (rhs->isNumber())
+        return DiagonalMatrix::prod(rhs);
+    if (cols() != rhs->rows())
+        throw runtime_error("Different number of colum");
+    // matrices are immutable, the product is rhs itself
+    return rhs;
+}
+
+shared_ptr<Matrix> IdentityMatrix::power(const shared_ptr<Matrix> rhs) const {
+    exponent(rhs);
+    return make_shared<IdentityMatrix>(*this);
+}
+
+shared_ptr<Matrix> IdentityMatrix::transpose() const {
+    return make_shared<IdentityMatrix>(*this);
+}
+
+shared_ptr<Matrix> IdentityMatrix::gem() const {
+    return make_shared<IdentityMatrix>(*this);
+}
+
+shared_ptr<Matrix> IdentityMatrix::inv() const {
+    return make_shared<IdentityMatrix>(*this);
+}
+
+shared_ptr<Matrix> IdentityMatrix::solve(const shared_ptr<Matrix> rhs) const {
+    if (rows() != rhs->rows())
+        throw runtime_error("Different number of rows");
+    return rhs;
+}
@@ -0,0 +1,172 @@
+#include "../include/lu.hxx"
+#include "../include/kernels.hxx"
+#include "../include/profile.hxx"
+#include "../include/threadpool.hxx"
+#include <algorithm>
+
+using namespace std;
+
+namespace {
+    const size_t PARALLEL_ELEMENTS = 1 << 15; ///< elements per task, smaller updates stay serial
+    const size_t PANEL = 128; ///< columns factorized at a time, depth of the trailing gemm
+
+    size_t rowGrain(size_t width) {
+        return max<size_t>(1, PARALLEL_ELEMENTS / max<size_t>(1, width));
+    }
+}
+
+// INFO: LU class implementation
+
+LU::LU(const Storage& data, bool revealRank) : m_lu(data.clone())
+                                             , m_rows(data.rows())
+                                             , m_sign(1)
+                                             , m_smallest(numeric_limits<double>::infinity()) {
+    size_t rows = m_lu.rows(), cols = m_lu.cols();
+    // a * b^2 - b^3 / 3 operations for b eliminations in a * b elements
+    double a = max(rows, cols), b = min(rows, cols);
+    static profile::Site site("lu");
+    profile::Scope scope(&site, a * b * b - b * b * b / 3);
+    double largest = 0;
+    for (size_t i = 0; i < rows; i++)
+        for (size_t j = 0; j < cols; j++)
+            largest = max(largest, fabs(m_lu(i, j)));
+    m_tolerance = tolerance(largest, max(rows, cols));
+    double tolerance = revealRank ? m_tolerance : 0;
+    size_t panel = revealRank ? cols : PANEL;
+    for (size_t i = 0; i < rows; i++)
+        m_rows[i] = i;
+
+    size_t r = 0;
+    for (size_t c = 0; c < cols && r < rows; c += panel) {
+        size_t width = min(panel, cols - c), first = r;
+        r = factorPanel(r, c, width, tolerance);
+        size_t found = r - first;
+        if (found == 0 || c + width == cols)
+            continue;
+        // rows of U right of the panel, the panel multipliers are applied to them by substitution
+        size_t right = c + width, rest = cols - right;
+        ThreadPool::instance().parallelFor(right, cols, rowGrain(found * found), [&](size_t lo, size_t hi) {
+            for (size_t k = 1; k < found; k++) {
+                double* out = m_lu.row(first + k);
+                for (size_t j = 0; j < k; j++) {
+                    double l = out[m_pivots[first + j]];
+                    const double* row = m_lu.row(first + j);
+                    for (size_t q = lo; q < hi; q++)
+                        out[q] -= l * row[q];
+                }
+            }
+        });
+        if (r == rows)
+            continue;
+        // trailing matrix update, A22 -= L21 * U12, with multipliers gathered from the pivot columns
+        Storage l21(rows - r, found);
+        ThreadPool::instance().parallelFor(r, rows, rowGrain(found), [&](size_t lo, size_t hi) {
+            for (size_t i = lo; i < hi; i++)
+                for (size_t j = 0; j < found; j++)
+                    l21(i - r, j) = m_lu(i, m_pivots[first + j]);
+        });
+        kernels::gemm(rows - r, rest, found, -1, l21.data(), l21.stride(), 1,
+                      m_lu.row(first) + right, m_lu.stride(), 1, 1, m_lu.row(r) + right, m_lu.stride());
+    }
+}
+
+size_t LU::factorPanel(size_t r, size_t c, size_t width, double tolerance) {
+    size_t rows = m_lu.rows(), end = c + width;
+    for (size_t col = c; col < end && r < rows; col++) {
+        size_t p = r;
+        for (size_t i = r + 1; i < rows; i++)
+            if (fabs(m_lu(i, col)) > fabs(m_lu(p, col)))
+                p = i;
+        if (fabs(m_lu(p, col)) <= tolerance) {
+            // zero column, or rounding residue of a dependent one when the rank is revealed
+            for (size_t i = r; i < rows; i++)
+                m_lu(i, col) = 0;
+            continue;
+        }
+        if (p != r) {
+            swap_ranges(m_lu.row(r), m_lu.row(r) + m_lu.cols(), m_lu.row(p));
+            swap(m_rows[r], m_rows[p]);
+            m_sign = -m_sign;
+        }
+        const double* pivot = m_lu.row(r);
+        m_smallest = min(m_smallest, fabs(pivot[col]));
+        ThreadPool::instance().parallelFor(r + 1, rows, rowGrain(end - col), [&](size_t lo, size_t hi) {
+            for (size_t i = lo; i < hi; i++) {
+                double* target = m_lu.row(i);
+                double l = target[col] / pivot[col];
+                target[col] = l;
+                for (size_t k = col + 1; k < end; k++)
+                    target[k] -= l * pivot[k];
+            }
+        });
+        m_pivots.push_back(col);
+        r++;
+    }
+    return r;
+}
+
+size_t LU::rank() const {
+    return m_pivots.size();
+}
+
+double LU::tolerance(double largest, size_t size) {
+    // every one of up to n eliminations may leave n * epsilon * largest of rounding in an element
+    return largest * size * size * numeric_limits<double>::epsilon();
+}
+
+bool LU::revealsRank() const {
+    return m_smallest > m_tolerance;
+}
+
+double LU::det() const {
+    if (rank() < m_lu.rows())
+        return 0;
+    double result = m_sign;
+    for (size_t i = 0; i < m_lu.rows(); i++)
+        result *= m_lu(i, i);
+    return result;
+}
+
+Storage LU::echelon() const {
+    Storage result = Storage::zeros(m_lu.rows(), m_lu.cols());
+    for (size_t i = 0; i < rank(); i++)
+        copy(m_lu.row(i) + m_pivots[i], m_lu.row(i) + m_lu.cols(), result.row(i) + m_pivots[i]);
+    return result;
+}
+
+Storage LU::solve(const Storage& b) const {
+    size_t n = m_lu.rows(), width = b.cols();
+    if (n != m_lu.cols())
+        throw runtime_error("Non square matrix");
+    if (b.rows() != n)
+        throw runtime_error("Different number of rows");
+    if (rank() < n)
+        throw runtime_error("Singular matrix");
+    Storage x(n, width);
+    for (size_t i = 0; i < n; i++)
+        copy(b.row(m_rows[i]), b.row(m_rows[i]) + width, x.row(i));
+    // columns of X are independent, every task substitutes a band of them
+    ThreadPool::instance().parallelFor(0, width, rowGrain(n * n / 8), [&](size_t lo, size_t hi) {
+        for (size_t i = 0; i < n; i++) {
+            double* out = x.row(i);
+            for (size_t j = 0; j < i; j++) {
+                double l = m_lu(i, j);
+                const double* row = x.row(j);
+                for (size_t k = lo; k < hi; k++)
+                    out[k] -= l * row[k];
+            }
+        }
+        for (size_t i = n; i-- > 0;) {
+            double* out = x.row(i);
+            for (size_t j = i + 1; j < n; j++) {
+                double u = m_lu(i, j);
+                const double* row = x.row(j);
+                for (size_t k = lo; k < hi; k++)
+                    out[k] -= u * row[k];
+            }
+            for (size_t k = lo; k < hi; k++)
+                out[k] /= m_lu(i, i);
+        }
+    });
+    return x;
+}
@@ -1,59 +1,188 @@
 #include "../include/matrix.hxx"
+#include "../include/kernels.hxx"
+#include "../include/lu.hxx"
+#include "../include/profile.hxx"
+#include "../include/threadpool.hxx"
+#include <algorithm>
 
 using namespace std;
+
+namespace {
+    const size_t PARALLEL_ELEMENTS = 1 << 15; ///< elements per task, smaller matrices stay serial
+    thread_local bool reuseLU = true; ///< see Matrix::reuseFactorizations
+
+    // rows per parallel task for rows of given width
+    size_t rowGrain(size_t width) {
+        return max<size_t>(1, PARALLEL_ELEMENTS / max<size_t>(1, width));
+    }
+
+    // runs body(lo, hi) over row ranges of [0, rows) on the thread pool
+    void forRows(size_t rows, size_t width, const function<void(size_t, size_t)>& body) {
+        ThreadPool::instance().parallelFor(0, rows, rowGrain(width), body);
+    }
+
+    // few enough non-zero elements to store the matrix sparse, counting stops past the limit
+    bool sparse(const Storage& data) {
+        size_t limit = SparseMatrix::maxNonzeros(data.rows(), data.cols()), count = 0;
+        if (limit == 0)
+            return false;
+        for (size_t i = 0; i < data.rows(); i++) {
+            const double* row = data.row(i);
+            for (size_t j = 0; j < data.cols(); j++)
+                if (row[j] != 0 && ++count > limit)
+                    return false;
+        }
+        return true;
+    }
+}
     
 // INFO: Matrix class implementation
 
-Matrix::Matrix()    :   m_data(vector<vector<double>>())
+Matrix::Matrix()    :   m_data()
                     ,   m_empty(true) {}
 
 Matrix::Matrix (const Matrix& matrix) : m_data(matrix.m_data)
-                                      , m_empty(matrix.m_empty) {}
+                                      , m_empty(matrix.m_empty)
+                                      , m_lu(atomic_load(&matrix.m_lu))
+                                      , m_rankLU(atomic_load(&matrix.m_rankLU)) {}
 
-Matrix::Matrix(vector<vector<double>> data){
-    size_t size = data[0].size();
-    for (size_t i = 1; i < data.size(); i++)
-        if (data[i].size() != size)
-            throw runtime_error("Rows have different sizes");
-    m_data = data;
-    m_empty = false;
-}
+Matrix::Matrix(vector<vector<double>> data)  :   m_data(data)
+                                            ,   m_empty(false) {}
+
+Matrix::Matrix(Storage data)    :   m_data(data)
+                                ,   m_empty(false) {}
 
 size_t Matrix::rows() const {
-    return m_data.size();
+    return m_data.rows();
 }
 
 size_t Matrix::cols() const {
-    return m_data[0].size();
+    return m_data.cols();
 }
 
 shared_ptr<Matrix> Matrix::transform() {
-    shared_ptr<Matrix> m;
-    if (this->isNumber()){
-        m = make_shared<Number>(this->get(0, 0));
-        return m->transform();
+    if (this->isEmpty()) {
+        this->m_empty = true;
+        return make_shared<Matrix>(*this);
     }
-    else if (this->isZero()){
-        m = make_shared<ZeroMatrix>(this->rows(), this->cols());
-        return m->transform();
+    static profile::Site site("transform");
+    profile::Scope scope(&site);
+    return classify(dense(), structure());
+}
+
+shared_ptr<Matrix> Matrix::classify(Storage data, Structure known) {
+    static profile::Site site("classify");
+    profile::Scope scope(&site);
+    size_t rows = data.rows(), cols = data.cols();
+    if (data.empty())
+        return make_shared<Matrix>();
+    if (rows == 1 && cols == 1)
+        return make_shared<Number>(data(0, 0));
+    if (rows != cols) {
+        for (size_t i = 0; i < rows; i++) {
+            const double* row = data.row(i);
+            for (size_t j = 0; j < cols; j++)
+                if (row[j] != 0) {
+                    if (sparse(data))
+                        return make_shared<SparseMatrix>(data);
+                    return make_shared<Matrix>(data);
+                }
+        }
+        return make_shared<ZeroMatrix>(rows, cols);
     }
-    else if (this->isSquare()){
-        m = make_shared<SquareMatrix>(*this);
-        return m->transform();
+    bool zero = true, diagonal = true, identity = true;
+    for (size_t i = 0; i < rows; i++) {
+        const double* row = data.row(i);
+        if (known == Structure::GENERAL)
+            for (size_t j = 0; j < i; j++)
+                if (row[j] != 0) {
+                    if (sparse(data))
+                        return make_shared<SparseMatrix>(data);
+                    return make_shared<SquareMatrix>(data);
+                }
+        zero = zero && row[i] == 0;
+        identity = identity && row[i] == 1;
+        if (known != Structure::DIAGONAL && diagonal)
+            for (size_t j = i + 1; j < cols; j++)
+                if (row[j] != 0) {
+                    diagonal = false;
+                    break;
+                }
     }
-    else if (this->isEmpty())
-        this->m_empty = true;
-    return make_shared<Matrix>(*this);
+    if (!diagonal && sparse(data))
+        return make_shared<SparseMatrix>(data);
+    if (!diagonal)
+        return make_shared<TriangularMatrix>(data);
+    if (zero)
+        return make_shared<ZeroMatrix>(rows, cols);
+    if (identity)
+        return make_shared<IdentityMatrix>(rows);
+    return make_shared<DiagonalMatrix>(data);
+}
+
+Structure Matrix::structure() const {
+    return Structure::GENERAL;
 }
 
 string Matrix::toString() const {
     stringstream ss;
+    print(ss);
+    return ss.str();
+}
+
+void Matrix::print(ostream& os) const {
+    vector<double> buffer(cols());
     for (size_t i = 0; i < this->rows(); i++){
+        const double* row = readRow(i, buffer.data());
         for (size_t j = 0; j < this->cols(); j++)
-            ss << this->get(i, j) << " ";
-        ss << endl;
+            os << row[j] << " ";
+        os << endl;
     }
-    return ss.str();
+}
+
+Layout Matrix::layout() const {
+    return Layout::DENSE;
+}
+
+const Storage& Matrix::storage() const {
+    return m_data;
+}
+
+bool Matrix::isDenseStored() const {
+    return true;
+}
+
+void Matrix::copyRows(size_t first, size_t last, double* out, size_t ld) const {
+    for (size_t i = first; i < last; i++, out += ld)
+        copy(m_data.row(i), m_data.row(i) + cols(), out);
+}
+
+bool Matrix::strided(const double*& data, size_t& rowStride, size_t& colStride) const {
+    if (!isDenseStored())
+        return false;
+    data = m_data.data();
+    rowStride = m_data.stride();
+    colStride = 1;
+    return true;
+}
+
+const double* Matrix::readRow(size_t row, double* buffer) const {
+    if (isDenseStored())
+        return m_data.row(row);
+    copyRows(row, row + 1, buffer, cols());
+    return buffer;
+}
+
+Storage Matrix::dense() const {
+    if (isDenseStored())
+        return m_data;
+    static profile::Site site("dense");
+    profile::Scope scope(&site);
+    Storage result(rows(), cols());
+    forRows(rows(), cols(), [&](size_t lo, size_t hi) {
+        copyRows(lo, hi, result.row(lo), result.stride());
+    });
+    return result;
 }
 
 bool Matrix::isEmpty() const {
@@ -65,10 +194,13 @@ bool Matrix::isNumber() const {
 }
 
 bool Matrix::isZero() const {
-    for (size_t i = 0; i < rows(); i++)
+    vector<double> buffer(cols());
+    for (size_t i = 0; i < rows(); i++) {
+        const double* row = readRow(i, buffer.data());
         for (size_t j = 0; j < cols(); j++)
-            if (this->get(i, j) != 0)
+            if (row[j] != 0)
                 return false;
+    }
     return true;
 }
 
@@ -76,12 +208,28 @@ bool Matrix::isSquare() const {
     return rows() == cols();
 }
 
+bool Matrix::isSparse() const {
+    return false;
+}
+
+bool Matrix::isView() const {
+    return false;
+}
+
+bool Matrix::isBlock() const {
+    return false;
+}
+
+bool Matrix::isFloat() const {
+    return false;
+}
+
 double Matrix::get(size_t row, size_t col) const {
     if (row >= rows())
         throw runtime_error("Row index out of range");
     if (col >= cols())
         throw runtime_error("Column index out of range");
-    return m_data[row][col];
+    return m_data(row, col);
 }
 
 double Matrix::number() const {
@@ -89,127 +237,206 @@ double Matrix::number() const {
 }
 
 shared_ptr<Matrix> Matrix::add(const shared_ptr<Matrix> rhs) const {
-    shared_ptr<Matrix> m;
     if (rows() != rhs->rows())
         throw runtime_error("Different number of rows");
     if (cols() != rhs->cols())
         throw runtime_error("Different number of columns");
-    vector<vector<double>> result(rows());
-    for (size_t i = 0; i < rows(); i++) {
-        result[i].resize(cols());
-        for (size_t j = 0; j < cols(); j++)
-            result[i][j] = this->get(i, j) + rhs->get(i, j);
-    }
-    m = make_shared<Matrix>(result);
-    return m->transform();
+    Storage lhsData = this->dense(), rhsData = rhs->dense();
+    Storage result(rows(), cols());
+    forRows(rows(), cols(), [&](size_t lo, size_t hi) {
+        for (size_t i = lo; i < hi; i++) {
+            const double* a = lhsData.row(i);
+            const double* b = rhsData.row(i);
+            double* out = result.row(i);
+            for (size_t j = 0; j < cols(); j++)
+                out[j] = a[j] + b[j];
+        }
+    });
+    return classify(result, meet(structure(), rhs->structure()));
 }
 
 shared_ptr<Matrix> Matrix::neg() const {
-    shared_ptr<Matrix> m;
-    vector<vector<double>> result(rows());
-    for (size_t i = 0; i < rows(); i++) {
-        result[i].resize(cols());
-        for (size_t j = 0; j < cols(); j++)
-            result[i][j] = -this->get(i, j);
-    }
-    m = make_shared<Matrix>(result);
-    return m->transform();
+    Storage data = this->dense();
+    Storage result(rows(), cols());
+    forRows(rows(), cols(), [&](size_t lo, size_t hi) {
+        for (size_t i = lo; i < hi; i++) {
+            const double* a = data.row(i);
+            double* out = result.row(i);
+            for (size_t j = 0; j < cols(); j++)
+                out[j] = -a[j];
+        }
+    });
+    return classify(result, structure());
 }
 
 shared_ptr<Matrix> Matrix::sub(const shared_ptr<Matrix> rhs) const {
-    return add(rhs->neg());
+    if (rows() != rhs->rows())
+        throw runtime_error("Different number of rows");
+    if (cols() != rhs->cols())
+        throw runtime_error("Different number of columns");
+    Storage lhsData = this->dense(), rhsData = rhs->dense();
+    Storage result(rows(), cols());
+    forRows(rows(), cols(), [&](size_t lo, size_t hi) {
+        for (size_t i = lo; i < hi; i++) {
+            const double* a = lhsData.row(i);
+            const double* b = rhsData.row(i);
+            double* out = result.row(i);
+            for (size_t j = 0; j < cols(); j++)
+                out[j] = a[j] - b[j];
+        }
+    });
+    return classify(result, meet(structure(), rhs->structure()));
 }
 
 shared_ptr<Matrix> Matrix::prod(const shared_ptr<Matrix> rhs) const {
     //scalar multiplication
     if (rhs->isNumber()){
-        shared_ptr<Matrix> m;
-        vector<vector<double>> result(this->rows());
+        Storage data = this->dense();
+        Storage result(this->rows(), cols());
         double n = rhs->number();
-        for (size_t i = 0; i < this->rows(); i++) {
-            result[i].resize(cols());
-            for (size_t j = 0; j < cols(); j++)
-                result[i][j] = this->get(i, j) * n;
-        }
-        m = make_shared<Matrix>(result);
-        return m->transform();
+        forRows(rows(), cols(), [&](size_t lo, size_t hi) {
+            for (size_t i = lo; i < hi; i++) {
+                const double* a = data.row(i);
+                double* out = result.row(i);
+                for (size_t j = 0; j < cols(); j++)
+                    out[j] = a[j] * n;
+            }
+        });
+        return classify(result, structure());
     }
     else if (cols() != rhs->rows())
         throw runtime_error("Different number of colum");
-    //matrix multiplication
-    shared_ptr<Matrix> m;
-    vector<vector<double>> result(this->rows());
-    for (size_t i = 0; i < this->rows(); i++) {
-        result[i].resize(rhs->cols());
-        for (size_t j = 0; j < rhs->cols(); j++) {
-            result[i][j] = 0;
-            for (size_t k = 0; k < cols(); k++)
-                result[i][j] += this->get(i, k) * rhs->get(k, j);
-        }
+    //diagonal rhs only scales the columns, identity leaves them as they are
+    if (rhs->structure() == Structure::DIAGONAL) {
+        vector<double> scale(rhs->cols());
+        for (size_t j = 0; j < rhs->cols(); j++)
+            scale[j] = rhs->get(j, j);
+        Storage data = this->dense();
+        if (all_of(scale.begin(), scale.end(), [](double x) { return x == 1; }))
+            return classify(data, structure());
+        Storage result(this->rows(), cols());
+        forRows(rows(), cols(), [&](size_t lo, size_t hi) {
+            for (size_t i = lo; i < hi; i++) {
+                const double* a = data.row(i);
+                double* out = result.row(i);
+                for (size_t j = 0; j < cols(); j++)
+                    out[j] = a[j] * scale[j];
+            }
+        });
+        return classify(result, structure());
+    }
+    //sparse rhs, its rows scaled by elements of a row of this matrix are added up
+    if (rhs->isSparse()) {
+        const SparseMatrix::Csr& csr = static_cast<const SparseMatrix&>(*rhs).csr();
+        Storage data = this->dense();
+        Storage result = Storage::zeros(this->rows(), rhs->cols());
+        forRows(rows(), cols(), [&](size_t lo, size_t hi) {
+            for (size_t i = lo; i < hi; i++) {
+                const double* a = data.row(i);
+                double* out = result.row(i);
+                for (size_t k = 0; k < cols(); k++) {
+                    if (a[k] == 0)
+                        continue;
+                    for (size_t p = csr.offsets[k]; p < csr.offsets[k + 1]; p++)
+                        out[csr.columns[p]] += a[k] * csr.values[p];
+                }
+            }
+        });
+        return classify(result);
     }
-    m = make_shared<Matrix>(result);
-    return m->transform();
+    //matrix multiplication, dense matrices and views are read in place
+    if (rhs->isFloat())
+        return FloatMatrix::multiply(*this, *rhs);
+    Storage lhsData, rhsData;
+    const double *a, *b;
+    size_t rsa, csa, rsb, csb;
+    if (!this->strided(a, rsa, csa)) {
+        lhsData = this->dense();
+        a = lhsData.data(), rsa = lhsData.stride(), csa = 1;
+    }
+    if (!rhs->strided(b, rsb, csb)) {
+        rhsData = rhs->dense();
+        b = rhsData.data(), rsb = rhsData.stride(), csb = 1;
+    }
+    Storage result(this->rows(), rhs->cols());
+    kernels::gemm(this->rows(), rhs->cols(), cols(), 1,
+                  a, rsa, csa,
+                  b, rsb, csb,
+                  0, result.data(), result.stride());
+    // products of upper triangular matrices are upper triangular, the same holds for diagonal ones
+    return classify(result, meet(structure(), rhs->structure()));
 }
 
 shared_ptr<Matrix> Matrix::div(const shared_ptr<Matrix> rhs) const {
     double n = rhs->number();
     if (n == 0)
         throw runtime_error("Division by zero");
-    shared_ptr<Matrix> m, tmp;
-    tmp = make_shared<Number>(1 / n);
-    m = prod(tmp);
-    return m->transform();
+    return prod(make_shared<Number>(1 / n));
 }
 
 shared_ptr<Matrix> Matrix::power(const shared_ptr<Matrix>) const {
     throw runtime_error("Non-square matrix");
 }
 
+unsigned long long Matrix::exponent(const shared_ptr<Matrix>& rhs) {
+    double n;
+    // comparisons with NaN are false, it would pass every check below
+    if (!isfinite(rhs->number()))
+        throw runtime_error("Non-integer power");
+    if (modf(rhs->number(), &n) > numeric_limits<double>::epsilon() * 10)
+        throw runtime_error("Non-integer power");
+    if (n < 0)
+        throw runtime_error("Negative matrix power");
+    if (n >= 18446744073709551616.0) // 2^64
+        throw runtime_error("Matrix power too large");
+    return n;
+}
+
 shared_ptr<Matrix> Matrix::transpose() const {
-    shared_ptr<Matrix> m;
-    vector<vector<double>> result(cols());
-    for (size_t i = 0; i < cols(); i++) {
-        result[i].resize(rows());
-        for (size_t j = 0; j < rows(); j++)
-            result[i][j] = this->get(j, i);
-    }
-    m = make_shared<Matrix>(result);
-    return m->transform();
+    // rows of a dense matrix are columns of its transpose, large ones are only viewed that way
+    if (isDenseStored() && rows() * cols() >= ViewMatrix::MIN_ELEMENTS)
+        return ViewMatrix::create(m_data, 0, cols(), rows(), 1, m_data.stride());
+    const size_t TILE = 32; // a tile of source rows and one of result rows stay in L1
+    Storage data = this->dense();
+    Storage result(cols(), rows());
+    size_t tiles = (cols() + TILE - 1) / TILE;
+    ThreadPool::instance().parallelFor(0, tiles, rowGrain(rows() * TILE), [&](size_t lo, size_t hi) {
+        for (size_t ib = lo * TILE; ib < min(cols(), hi * TILE); ib += TILE)
+            for (size_t jb = 0; jb < rows(); jb += TILE)
+                for (size_t j = jb; j < min(rows(), jb + TILE); j++) {
+                    const double* src = data.row(j);
+                    for (size_t i = ib; i < min(cols(), ib + TILE); i++)
+                        result(i, j) = src[i];
+                }
+    });
+    // a transposed diagonal matrix is the same matrix, an upper triangular one becomes lower
+    return classify(result, structure() == Structure::DIAGONAL ? Structure::DIAGONAL : Structure::GENERAL);
 }
 
 shared_ptr<Matrix> Matrix::hconcat(const shared_ptr<Matrix> rhs) const {
     if (rows() != rhs->rows())
         throw runtime_error("Different number of rows");
-    shared_ptr<Matrix> m;
-    vector<vector<double>> result(rows());
-    for (size_t i = 0; i < rows(); i++) {
-        result[i].resize(cols() + rhs->cols());
-        for (size_t j = 0; j < cols(); j++)
-            result[i][j] = this->get(i, j);
-        for (size_t j = 0; j < rhs->cols(); j++)
-            result[i][j + cols()] = rhs->get(i, j);
-    }
-    m = make_shared<Matrix>(result);
-    return m->transform();
+    Storage result(rows(), cols() + rhs->cols());
+    forRows(rows(), result.cols(), [&](size_t lo, size_t hi) {
+        this->copyRows(lo, hi, result.row(lo), result.stride());
+        rhs->copyRows(lo, hi, result.row(lo) + cols(), result.stride());
+    });
+    return classify(result);
 }
 
 shared_ptr<Matrix> Matrix::vconcat(const shared_ptr<Matrix> rhs) const {
     if (cols() != rhs->cols())
         throw runtime_error("Different number of columns");
-    shared_ptr<Matrix> m;
-    vector<vector<double>> result(rows() + rhs->rows());
-    for (size_t i = 0; i < rows(); i++) {
-        result[i].resize(cols());
-        for (size_t j = 0; j < cols(); j++)
-            result[i][j] = this->get(i, j);
-    }
-    for (size_t i = 0; i < rhs->rows(); i++) {
-        result[i + rows()].resize(cols());
-        for (size_t j = 0; j < cols(); j++)
-            result[i + rows()][j] = rhs->get(i, j);
-    }
-    m = make_shared<Matrix>(result);
-    return m->transform();
+    Storage result(rows() + rhs->rows(), cols());
+    forRows(result.rows(), cols(), [&](size_t lo, size_t hi) {
+        if (lo < rows())
+            this->copyRows(lo, min(hi, rows()), result.row(lo), result.stride());
+        if (hi > rows()) {
+            size_t first = max(lo, rows());
+            rhs->copyRows(first - rows(), hi - rows(), result.row(first), result.stride());
+        }
+    });
+    return classify(result);
 }
 
 shared_ptr<Matrix> Matrix::crop(const shared_ptr<Matrix> rhs) const{
@@ -259,15 +486,7 @@ shared_ptr<Matrix> Matrix::crop(const shared_ptr<Matrix> rhs) const{
             throw runtime_error("Invalid parameters");
         }
         else{
-            shared_ptr<Matrix> m;
-            vector<vector<double>> result(rows);
-            for (size_t i = 0; i < rows; i++) {
-                result[i].resize(cols);
-                for (size_t j = 0; j < cols; j++)
-                    result[i][j] = this->get(i + verticalOffset, j + horizontalOffset);
-            }
-            m = make_shared<Matrix>(result);
-            return m->transform();
+            return region(verticalOffset, horizontalOffset, rows, cols);
         }
 
     }
@@ -276,45 +495,74 @@ shared_ptr<Matrix> Matrix::crop(const shared_ptr<Matrix> rhs) const{
     }
 }
 
-// TODO: implement rank
+shared_ptr<Matrix> Matrix::region(size_t top, size_t left, size_t rows, size_t cols) const {
+    if (isDenseStored())
+        return ViewMatrix::create(m_data, top * m_data.stride() + left, rows, cols, m_data.stride(), 1);
+    Storage result(rows, cols);
+    forRows(rows, this->cols(), [&](size_t lo, size_t hi) {
+        vector<double> buffer(this->cols());
+        for (size_t i = lo; i < hi; i++) {
+            const double* src = readRow(i + top, buffer.data()) + left;
+            copy(src, src + cols, result.row(i));
+        }
+    });
+    return classify(result);
+}
+
 shared_ptr<Matrix> Matrix::rank() const {
-    shared_ptr<Matrix> m;
-    m = this->gem();
-    size_t rank = 0;
-    for (size_t i = 0; i < m->rows(); i++) {
-        bool isZero = true;
-        for (size_t j = 0; j < m->cols(); j++)
-            if (m->get(i, j) != 0) {
-                isZero = false;
-                break;
-            }
-        if (!isZero)
-            rank++;
-    }
-    return make_shared<Number>(rank);
+    return make_shared<Number>(rankFactorization()->rank());
 }
 
 shared_ptr<Matrix> Matrix::gem() const {
-    shared_ptr<Matrix> m;
-    vector<vector<double>> result(this->rows(), vector<double>(this->cols()));
-    for (size_t z = 0; z < this->rows(); z++)
-        for (size_t k = 0; k < this->cols(); k++)
-            result[z][k] = this->get(z, k);
-    for (size_t i = 0; i < this->rows(); i++) {
-        size_t j = i;
-        while (j < this->rows() && result[j][i] == 0)
-            j++;
-        if (j == this->rows())
-            continue;
-        result[i].swap(result[j]);
-        for (size_t j = i + 1; j < this->rows(); j++) {
-            double c = result[j][i] / result[i][i];
-            for (size_t k = i; k < this->cols(); k++)
-                result[j][k] -= result[i][k] * c;
-        }
+    // row echelon form of a square matrix is upper triangular
+    return classify(rankFactorization()->echelon(), this->isSquare() ? Structure::UPPER : Structure::GENERAL);
+}
+
+shared_ptr<Matrix> Matrix::inv() const {
+    if (!this->isSquare())
+        throw runtime_error("Non square matrix");
+    Storage identity = Storage::zeros(rows(), cols());
+    for (size_t i = 0; i < rows(); i++)
+        identity(i, i) = 1;
+    return classify(factorization()->solve(identity));
+}
+
+shared_ptr<Matrix> Matrix::solve(const shared_ptr<Matrix> rhs) const {
+    if (!this->isSquare())
+        throw runtime_error("Non square matrix");
+    if (rows() != rhs->rows())
+        throw runtime_error("Different number of rows");
+    return classify(factorization()->solve(rhs->dense()));
+}
+
+void Matrix::reuseFactorizations(bool reuse) {
+    reuseLU = reuse;
+}
+
+shared_ptr<const LU> Matrix::factorization() const {
+    if (!reuseLU)
+        return make_shared<const LU>(this->dense());
+    // two threads may both factorize, either result is the same
+    shared_ptr<const LU> lu = atomic_load(&m_lu);
+    if (lu == nullptr) {
+        lu = make_shared<const LU>(this->dense());
+        atomic_store(&m_lu, lu);
+    }
+    return lu;
+}
+
+shared_ptr<const LU> Matrix::rankFactorization() const {
+    shared_ptr<const LU> lu = factorization();
+    if (lu->revealsRank())
+        return lu;
+    if (!reuseLU)
+        return make_shared<const LU>(this->dense(), true);
+    lu = atomic_load(&m_rankLU);
+    if (lu == nullptr) {
+        lu = make_shared<const LU>(this->dense(), true);
+        atomic_store(&m_rankLU, lu);
     }
-    m = make_shared<Matrix>(result);
-    return m->transform();
+    return lu;
 }
 
 shared_ptr<Matrix> Matrix::det () const{
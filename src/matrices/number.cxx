@@ -3,7 +3,9 @@
 using namespace std;
 
 Number::Number(const Number& matrix): Matrix(matrix) {}
-Number::Number(double m): Matrix(vector<vector<double>>(1, vector<double>(1, m))) {}
+Number::Number(double m): Matrix(Storage(1, 1)) {
+    m_data(0, 0) = m;
+}
 
 shared_ptr<Matrix> Number::transform(){
     return make_shared<Number>(this->number());
@@ -14,7 +16,7 @@ bool Number::isNumber() const{
 }
 
 double Number::number() const{
-    return m_data[0][0];
+    return m_data(0, 0);
 }
 
 shared_ptr<Matrix> Number::add(const shared_ptr<Matrix> rhs) const{
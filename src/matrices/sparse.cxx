@@ -0,0 +1,383 @@
+#include "../include/matrix.hxx"
+#include "../include/lu.hxx"
+#include "../include/threadpool.hxx"
+#include <algorithm>
+
+using namespace std;
+
+namespace {
+    const size_t PARALLEL_ELEMENTS = 1 << 15; ///< stored elements per task, smaller products stay serial
+    const size_t NONE = static_cast<size_t>(-1);
+
+    // rows per parallel task when a row costs about width operations
+    size_t rowGrain(size_t width) {
+        return max<size_t>(1, PARALLEL_ELEMENTS / max<size_t>(1, width));
+    }
+
+    // appends element (row being built, col) unless it is zero
+    void push(SparseMatrix::Csr& csr, size_t col, double value) {
+        if (value == 0)
+            return;
+        csr.columns.push_back(col);
+        csr.values.push_back(value);
+    }
+
+    // every element multiplied by factor, products which underflow to zero are dropped
+    SparseMatrix::Csr scale(const SparseMatrix::Csr& a, double factor) {
+        SparseMatrix::Csr result;
+        result.offsets.push_back(0);
+        for (size_t i = 0; i + 1 < a.offsets.size(); i++) {
+            for (size_t k = a.offsets[i]; k < a.offsets[i + 1]; k++)
+                push(result, a.columns[k], a.values[k] * factor);
+            result.offsets.push_back(result.values.size());
+        }
+        return result;
+    }
+
+    // a + sign * b for matrices of the same size, rows are merged by column
+    SparseMatrix::Csr merge(const SparseMatrix::Csr& a, const SparseMatrix::Csr& b, double sign) {
+        SparseMatrix::Csr result;
+        result.offsets.push_back(0);
+        result.columns.reserve(a.values.size() + b.values.size());
+        result.values.reserve(a.values.size() + b.values.size());
+        for (size_t i = 0; i + 1 < a.offsets.size(); i++) {
+            size_t p = a.offsets[i], q = b.offsets[i];
+            while (p < a.offsets[i + 1] || q < b.offsets[i + 1]) {
+                if (q == b.offsets[i + 1] || (p < a.offsets[i + 1] && a.columns[p] < b.columns[q])) {
+                    push(result, a.columns[p], a.values[p]);
+                    p++;
+                } else if (p == a.offsets[i + 1] || b.columns[q] < a.columns[p]) {
+                    push(result, b.columns[q], sign * b.values[q]);
+                    q++;
+                } else {
+                    push(result, a.columns[p], a.values[p] + sign * b.values[q]);
+                    p++;
+                    q++;
+                }
+            }
+            result.offsets.push_back(result.values.size());
+        }
+        return result;
+    }
+
+    // product of compressed matrices, b has width columns
+    SparseMatrix::Csr multiply(const SparseMatrix::Csr& a, const SparseMatrix::Csr& b, size_t width) {
+        size_t rows = a.offsets.size() - 1;
+        SparseMatrix::Csr result;
+        result.offsets.assign(rows + 1, 0);
+        // flops of a row, used to size the parallel tasks
+        size_t flops = 0;
+        for (size_t k = 0; k < a.values.size(); k++)
+            flops += b.offsets[a.columns[k] + 1] - b.offsets[a.columns[k]];
+        size_t grain = rowGrain(flops / max<size_t>(1, rows));
+
+        // first pass counts distinct columns of every row of the result
+        ThreadPool::instance().parallelFor(0, rows, grain, [&](size_t lo, size_t hi) {
+            vector<size_t> marker(width, NONE);
+            for (size_t i = lo; i < hi; i++) {
+                size_t count = 0;
+                for (size_t p = a.offsets[i]; p < a.offsets[i + 1]; p++) {
+                    size_t k = a.columns[p];
+                    for (size_t q = b.offsets[k]; q < b.offsets[k + 1]; q++)
+                        if (marker[b.columns[q]] != i) {
+                            marker[b.columns[q]] = i;
+                            count++;
+                        }
+                }
+                result.offsets[i + 1] = count;
+            }
+        });
+        for (size_t i = 0; i < rows; i++)
+            result.offsets[i + 1] += result.offsets[i];
+        result.columns.resize(result.offsets[rows]);
+        result.values.resize(result.offsets[rows]);
+
+        // second pass accumulates every row in a dense buffer and gathers it in column order
+        ThreadPool::instance().parallelFor(0, rows, grain, [&](size_t lo, size_t hi) {
+            vector<size_t> marker(width, NONE);
+            vector<double> accumulator(width);
+            for (size_t i = lo; i < hi; i++) {
+                size_t* columns = result.columns.data() + result.offsets[i];
+                size_t count = 0;
+                for (size_t p = a.offsets[i]; p < a.offsets[i + 1]; p++) {
+                    size_t k = a.columns[p];
+                    for (size_t q = b.offsets[k]; q < b.offsets[k + 1]; q++) {
+                        size_t j = b.columns[q];
+                        if (marker[j] != i) {
+                            marker[j] = i;
+                            accumulator[j] = 0;
+                            columns[count++] = j;
+                        }
+                        accumulator[j] += a.values[p] * b.values[q];
+                    }
+                }
+                sort(columns, columns + count);
+                for (size_t c = 0; c < count; c++)
+                    result.values[result.offsets[i] + c] = accumulator[columns[c]];
+            }
+        });
+
+        // elements which cancelled out are removed
+        if (find(result.values.begin(), result.values.end(), 0.0) == result.values.end())
+            return result;
+        SparseMatrix::Csr compact;
+        compact.offsets.push_back(0);
+        for (size_t i = 0; i < rows; i++) {
+            for (size_t k = result.offsets[i]; k < result.offsets[i + 1]; k++)
+                push(compact, result.columns[k], result.values[k]);
+            compact.offsets.push_back(compact.values.size());
+        }
+        return compact;
+    }
+}
+
+// INFO: SparseMatrix class implementation
+
+SparseMatrix::SparseMatrix(const Storage& data) : Matrix()
+                                                , m_rows(data.rows())
+                                                , m_cols(data.cols()) {
+    Csr csr;
+    csr.offsets.push_back(0);
+    for (size_t i = 0; i < m_rows; i++) {
+        const double* row = data.row(i);
+        for (size_t j = 0; j < m_cols; j++)
+            push(csr, j, row[j]);
+        csr.offsets.push_back(csr.values.size());
+    }
+    m_csr = make_shared<const Csr>(move(csr));
+    m_empty = false;
+}
+
+SparseMatrix::SparseMatrix(size_t rows, size_t cols, Csr csr)   : Matrix()
+                                                                , m_rows(rows)
+                                                                , m_cols(cols)
+                                                                , m_csr(make_shared<const Csr>(move(csr))) {
+    m_empty = false;
+}
+
+SparseMatrix::SparseMatrix(const SparseMatrix& matrix)  : Matrix(matrix)
+                                                        , m_rows(matrix.m_rows)
+                                                        , m_cols(matrix.m_cols)
+                                                        , m_csr(matrix.m_csr) {}
+
+size_t SparseMatrix::maxNonzeros(size_t rows, size_t cols) {
+    size_t size = rows * cols;
+    if (size < MIN_ELEMENTS)
+        return 0;
+    return size * DENSITY;
+}
+
+shared_ptr<Matrix> SparseMatrix::build(size_t rows, size_t cols, Csr csr) {
+    if (rows == 0 || cols == 0)
+        return make_shared<Matrix>();
+    if (rows == 1 && cols == 1)
+        return make_shared<Number>(csr.values.empty() ? 0 : csr.values[0]);
+    if (csr.values.empty())
+        return make_shared<ZeroMatrix>(rows, cols);
+    bool diagonal = rows == cols;
+    for (size_t i = 0; i < rows && diagonal; i++)
+        for (size_t k = csr.offsets[i]; k < csr.offsets[i + 1] && diagonal; k++)
+            diagonal = csr.columns[k] == i;
+    if (diagonal) {
+        Storage elements = Storage::zeros(1, rows);
+        for (size_t i = 0; i < rows; i++)
+            if (csr.offsets[i] < csr.offsets[i + 1])
+                elements(0, i) = csr.values[csr.offsets[i]];
+        return DiagonalMatrix::fromDiagonal(elements);
+    }
+    if (csr.values.size() > maxNonzeros(rows, cols)) {
+        Storage data = Storage::zeros(rows, cols);
+        for (size_t i = 0; i < rows; i++)
+            for (size_t k = csr.offsets[i]; k < csr.offsets[i + 1]; k++)
+                data(i, csr.columns[k]) = csr.values[k];
+        return classify(data);
+    }
+    return make_shared<SparseMatrix>(rows, cols, move(csr));
+}
+
+size_t SparseMatrix::rows() const {
+    return m_rows;
+}
+
+size_t SparseMatrix::cols() const {
+    return m_cols;
+}
+
+const SparseMatrix::Csr& SparseMatrix::csr() const {
+    return *m_csr;
+}
+
+size_t SparseMatrix::nonzeros() const {
+    return m_csr->values.size();
+}
+
+shared_ptr<Matrix> SparseMatrix::transform() {
+    return make_shared<SparseMatrix>(*this);
+}
+
+bool SparseMatrix::isZero() const {
+    return m_csr->values.empty();
+}
+
+bool SparseMatrix::isSparse() const {
+    return true;
+}
+
+Layout SparseMatrix::layout() const {
+    return Layout::SPARSE;
+}
+
+bool SparseMatrix::isDenseStored() const {
+    return false;
+}
+
+void SparseMatrix::copyRows(size_t first, size_t last, double* out, size_t ld) const {
+    for (size_t i = first; i < last; i++, out += ld) {
+        fill(out, out + m_cols, 0.0);
+        for (size_t k = m_csr->offsets[i]; k < m_csr->offsets[i + 1]; k++)
+            out[m_csr->columns[k]] = m_csr->values[k];
+    }
+}
+
+double SparseMatrix::get(size_t row, size_t col) const {
+    if (row >= rows())
+        throw runtime_error("Row index out of range");
+    if (col >= cols())
+        throw runtime_error("Column index out of range");
+    auto first = m_csr->columns.begin() + m_csr->offsets[row], last = m_csr->columns.begin() + m_csr->offsets[row + 1];
+    auto found = lower_bound(first, last, col);
+    if (found == last || *found != col)
+        return 0;
+    return m_csr->values[found - m_csr->columns.begin()];
+}
+
+shared_ptr<Matrix> SparseMatrix::add(const shared_ptr<Matrix> rhs) const {
+    if (!rhs->isSparse() || rows() != rhs->rows() || cols() != rhs->cols())
+        return Matrix::add(rhs);
+    return build(rows(), cols(), merge(*m_csr, static_cast<const SparseMatrix&>(*rhs).csr(), 1));
+}
+
+shared_ptr<Matrix> SparseMatrix::neg() const {
+    return build(rows(), cols(), scale(*m_csr, -1));
+}
+
+shared_ptr<Matrix> SparseMatrix::sub(const shared_ptr<Matrix> rhs) const {
+    if (!rhs->isSparse() || rows() != rhs->rows() || cols() != rhs->cols())
+        return Matrix::sub(rhs);
+    return build(rows(), cols(), merge(*m_csr, static_cast<const SparseMatrix&>(*rhs).csr(), -1));
+}
+
+shared_ptr<Matrix> SparseMatrix::prod(const shared_ptr<Matrix> rhs) const {
+    //scalar multiplication
+    if (rhs->isNumber())
+        return build(rows(), cols(), scale(*m_csr, rhs->number()));
+    if (cols() != rhs->rows())
+        throw runtime_error("Different number of colum");
+    if (rhs->isSparse())
+        return build(rows(), rhs->cols(), multiply(*m_csr, static_cast<const SparseMatrix&>(*rhs).csr(), rhs->cols()));
+    //every stored element scales a row of rhs
+    Storage data = rhs->dense();
+    Storage result = Storage::zeros(rows(), rhs->cols());
+    size_t width = rhs->cols() * max<size_t>(1, nonzeros() / max<size_t>(1, rows()));
+    ThreadPool::instance().parallelFor(0, rows(), rowGrain(width), [&](size_t lo, size_t hi) {
+        for (size_t i = lo; i < hi; i++) {
+            double* out = result.row(i);
+            for (size_t k = m_csr->offsets[i]; k < m_csr->offsets[i + 1]; k++) {
+                const double* row = data.row(m_csr->columns[k]);
+                double a = m_csr->values[k];
+                for (size_t j = 0; j < result.cols(); j++)
+                    out[j] += a * row[j];
+            }
+        }
+    });
+    return classify(result);
+}
+
+shared_ptr<Matrix> SparseMatrix::power(const shared_ptr<Matrix> rhs) const {
+    if (rows() != cols())
+        throw runtime_error("Non-square matrix");
+    unsigned long long n = exponent(rhs);
+    if (n == 0)
+        return make_shared<IdentityMatrix>(rows());
+    // products may fill in and turn dense, every step picks its own type
+    shared_ptr<Matrix> base = make_shared<SparseMatrix>(*this), result;
+    while (true) {
+        if (n & 1)
+            result = result == nullptr ? base : result->prod(base);
+        n >>= 1;
+        if (n == 0)
+            break;
+        base = base->prod(base);
+    }
+    return result;
+}
+
+shared_ptr<Matrix> SparseMatrix::transpose() const {
+    Csr result;
+    result.offsets.assign(cols() + 1, 0);
+    for (size_t k = 0; k < nonzeros(); k++)
+        result.offsets[m_csr->columns[k] + 1]++;
+    for (size_t j = 0; j < cols(); j++)
+        result.offsets[j + 1] += result.offsets[j];
+    result.columns.resize(nonzeros());
+    result.values.resize(nonzeros());
+    vector<size_t> next(result.offsets.begin(), result.offsets.end() - 1);
+    // rows are visited in order, so columns of the result come out sorted
+    for (size_t i = 0; i < rows(); i++)
+        for (size_t k = m_csr->offsets[i]; k < m_csr->offsets[i + 1]; k++) {
+            size_t position = next[m_csr->columns[k]]++;
+            result.columns[position] = i;
+            result.values[position] = m_csr->values[k];
+        }
+    return build(cols(), rows(), move(result));
+}
+
+shared_ptr<Matrix> SparseMatrix::hconcat(const shared_ptr<Matrix> rhs) const {
+    if (rows() != rhs->rows())
+        throw runtime_error("Different number of rows");
+    if (!rhs->isSparse())
+        return Matrix::hconcat(rhs);
+    const Csr& other = static_cast<const SparseMatrix&>(*rhs).csr();
+    Csr result;
+    result.offsets.push_back(0);
+    for (size_t i = 0; i < rows(); i++) {
+        for (size_t k = m_csr->offsets[i]; k < m_csr->offsets[i + 1]; k++)
+            push(result, m_csr->columns[k], m_csr->values[k]);
+        for (size_t k = other.offsets[i]; k < other.offsets[i + 1]; k++)
+            push(result, other.columns[k] + cols(), other.values[k]);
+        result.offsets.push_back(result.values.size());
+    }
+    return build(rows(), cols() + rhs->cols(), move(result));
+}
+
+shared_ptr<Matrix> SparseMatrix::vconcat(const shared_ptr<Matrix> rhs) const {
+    if (cols() != rhs->cols())
+        throw runtime_error("Different number of columns");
+    if (!rhs->isSparse())
+        return Matrix::vconcat(rhs);
+    const Csr& other = static_cast<const SparseMatrix&>(*rhs).csr();
+    Csr result = *m_csr;
+    result.columns.insert(result.columns.end(), other.columns.begin(), other.columns.end());
+    result.values.insert(result.values.end(), other.values.begin(), other.values.end());
+    for (size_t i = 1; i < other.offsets.size(); i++)
+        result.offsets.push_back(nonzeros() + other.offsets[i]);
+    return build(rows() + rhs->rows(), cols(), move(result));
+}
+
+shared_ptr<Matrix> SparseMatrix::det() const {
+    if (rows() != cols())
+        throw runtime_error("Non square matrix");
+    return make_shared<Number>(factorization()->det());
+}
+
+shared_ptr<Matrix> SparseMatrix::region(size_t top, size_t left, size_t rows, size_t cols) const {
+    Csr result;
+    result.offsets.push_back(0);
+    for (size_t i = top; i < top + rows; i++) {
+        auto first = m_csr->columns.begin() + m_csr->offsets[i], last = m_csr->columns.begin() + m_csr->offsets[i + 1];
+        for (auto it = lower_bound(first, last, left); it != last && *it < left + cols; ++it)
+            push(result, *it - left, m_csr->values[it - m_csr->columns.begin()]);
+        result.offsets.push_back(result.values.size());
+    }
+    return build(rows, cols, move(result));
+}
@@ -1,4 +1,7 @@
 #include "../include/matrix.hxx"
+#include "../include/kernels.hxx"
+#include "../include/lu.hxx"
+#include <algorithm>
 
 using namespace std;
 
@@ -10,13 +13,17 @@ SquareMatrix::SquareMatrix()    : Matrix()
 SquareMatrix::SquareMatrix(const SquareMatrix& matrix)    : Matrix(matrix)
                                                           , m_size(matrix.rows()) {}
 
-SquareMatrix::SquareMatrix(const Matrix& matrix)    : Matrix(vector<vector<double>>(matrix.rows(), vector<double>(matrix.rows())))
+SquareMatrix::SquareMatrix(const Matrix& matrix)    : Matrix(Storage(matrix.rows(), matrix.rows()))
                                                     , m_size(matrix.rows()){
     if (matrix.rows() != matrix.cols())
         throw runtime_error("Non-square matrix");
-    for (size_t i = 0; i < matrix.cols(); i++)
-        for (size_t j = 0; j < matrix.cols(); j++)
-            m_data[i][j] = matrix.get(i, j);
+    matrix.copyRows(0, matrix.rows(), m_data.data(), m_data.stride());
+}
+
+SquareMatrix::SquareMatrix(Storage data)    : Matrix(data)
+                                            , m_size(data.rows()){
+    if (data.rows() != data.cols())
+        throw runtime_error("Non-square matrix");
 }
 
 size_t SquareMatrix::rows() const {
@@ -27,13 +34,7 @@ size_t SquareMatrix::cols() const {
 }
 
 shared_ptr<Matrix> SquareMatrix::transform(){
-    shared_ptr<Matrix> m;
-    if (this->isTriangular()){
-        m = make_shared<TriangularMatrix>(*this);
-        return m->transform();
-    }
-    else
-        return make_shared<SquareMatrix>(*this);
+    return classify(m_data);
 }
 
 bool SquareMatrix::isSquare() const {
@@ -41,35 +42,39 @@ bool SquareMatrix::isSquare() const {
 }
 
 bool SquareMatrix::isTriangular() const {
-    for (size_t i = 1; i < this->rows(); i++)
+    vector<double> buffer(cols());
+    for (size_t i = 1; i < this->rows(); i++) {
+        const double* row = readRow(i, buffer.data());
         for (size_t j = 0; j < i; j++)
-            if (this->get(i, j) != 0)
+            if (row[j] != 0)
                 return false;
+    }
     return true;
 }
 
 shared_ptr<Matrix> SquareMatrix::power(const shared_ptr<Matrix> rhs) const {
-    shared_ptr<Matrix> m;
-    double n;
-    if (modf(rhs->number(), &n) > numeric_limits<double>::epsilon() * 10)
-        throw runtime_error("Non-integer power");
-    if (n < 0)
-        throw runtime_error("Negative matrix power");
-    if (n > 100)
-        throw runtime_error("Matrix power too large");
-    m = make_shared<IdentityMatrix>(this->rows());
-    for (size_t i = 0; i < n; i++) {
-        m = this->prod(m);
-        m = m->transform();
+    unsigned long long n = exponent(rhs);
+    if (n == 0)
+        return make_shared<IdentityMatrix>(this->rows());
+    // intermediate products stay plain storage, only the result is classified
+    size_t size = this->rows();
+    auto multiply = [size](const Storage& a, const Storage& b) {
+        Storage c(size, size);
+        kernels::gemm(size, size, size, 1, a.data(), a.stride(), 1, b.data(), b.stride(), 1, 0, c.data(), c.stride());
+        return c;
+    };
+    Storage base = this->dense(), result;
+    while (true) {
+        if (n & 1)
+            result = result.empty() ? base : multiply(result, base);
+        n >>= 1;
+        if (n == 0)
+            break;
+        base = multiply(base, base);
     }
-    return m->transform();
+    return classify(result);
 }
 
 shared_ptr<Matrix> SquareMatrix::det() const {
-    shared_ptr<Matrix> m;
-    m = this->gem();
-    double result = 1;
-    for (size_t i = 0; i < m->rows(); i++)
-        result *= m->get(i, i);
-    return make_shared<Number>(result);
+    return make_shared<Number>(factorization()->det());
 }
@@ -0,0 +1,189 @@
+#include "../include/matrix.hxx"
+#include "../include/profile.hxx"
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <unordered_map>
+
+using namespace std;
+
+// INFO: Storage class implementation
+
+namespace {
+    // rows narrower than a cache line are kept dense, wider rows are padded to whole lines
+    size_t paddedStride(size_t cols) {
+        if (cols < Storage::LANES)
+            return cols;
+        return (cols + Storage::LANES - 1) / Storage::LANES * Storage::LANES;
+    }
+
+    const size_t POOL_BYTES = size_t(512) << 20; ///< released buffers kept at most, larger ones go back to the system
+    const size_t POOL_MIN_BYTES = 4096; ///< smaller buffers are left to the per-thread caches of the system allocator
+
+    // buffers released while a Storage::Pool is open, by number of elements
+    struct BufferPool {
+        mutex lock;
+        size_t open = 0;  ///< Storage::Pool objects alive
+        size_t bytes = 0; ///< size of the kept buffers
+        unordered_map<size_t, vector<double*>> kept;
+    };
+
+    // never destroyed, buffers of static matrices may be released after other statics are gone
+    BufferPool& pool() {
+        static BufferPool* instance = new BufferPool;
+        return *instance;
+    }
+
+    void release(double* d, size_t count) {
+        size_t bytes = count * sizeof(double);
+        profile::released(bytes);
+        if (bytes >= POOL_MIN_BYTES) {
+            BufferPool& p = pool();
+            lock_guard<mutex> guard(p.lock);
+            if (p.open > 0 && p.bytes + bytes <= POOL_BYTES) {
+                p.kept[count].push_back(d);
+                p.bytes += bytes;
+                return;
+            }
+        }
+        ::operator delete(d, align_val_t(Storage::ALIGNMENT));
+    }
+
+    // a kept buffer of the same size, nullptr if there is none
+    double* reuse(size_t count) {
+        BufferPool& p = pool();
+        lock_guard<mutex> guard(p.lock);
+        auto found = p.kept.find(count);
+        if (found == p.kept.end() || found->second.empty())
+            return nullptr;
+        double* d = found->second.back();
+        found->second.pop_back();
+        p.bytes -= count * sizeof(double);
+        return d;
+    }
+
+    shared_ptr<double> allocate(size_t count) {
+        if (count == 0)
+            return shared_ptr<double>();
+        double* d = count * sizeof(double) >= POOL_MIN_BYTES ? reuse(count) : nullptr;
+        profile::allocated(count * sizeof(double), d != nullptr);
+        if (d == nullptr)
+            d = static_cast<double*>(::operator new(count * sizeof(double), align_val_t(Storage::ALIGNMENT)));
+        return shared_ptr<double>(d, [count](double* d) {
+            release(d, count);
+        });
+    }
+}
+
+Storage::Pool::Pool() {
+    BufferPool& p = pool();
+    lock_guard<mutex> guard(p.lock);
+    p.open++;
+}
+
+Storage::Pool::~Pool() {
+    // the last statement to finish frees the kept buffers
+    unordered_map<size_t, vector<double*>> kept;
+    {
+        BufferPool& p = pool();
+        lock_guard<mutex> guard(p.lock);
+        if (--p.open > 0)
+            return;
+        kept.swap(p.kept);
+        p.bytes = 0;
+    }
+    for (auto& size : kept)
+        for (double* d : size.second)
+            ::operator delete(d, align_val_t(Storage::ALIGNMENT));
+}
+
+Storage::Storage()  :   m_buffer()
+                    ,   m_rows(0)
+                    ,   m_cols(0)
+                    ,   m_stride(0) {}
+
+Storage::Storage(size_t rows, size_t cols)  :   m_rows(rows)
+                                            ,   m_cols(cols)
+                                            ,   m_stride(paddedStride(cols)) {
+    m_buffer = allocate(m_rows * m_stride);
+    // padding is written to binary files and may be read by vector loops, it never holds garbage
+    if (m_stride > m_cols)
+        for (size_t i = 0; i < m_rows; i++)
+            fill(row(i) + m_cols, row(i) + m_stride, 0.0);
+}
+
+Storage Storage::zeros(size_t rows, size_t cols) {
+    Storage result(rows, cols);
+    if (!result.empty())
+        memset(result.data(), 0, rows * result.stride() * sizeof(double));
+    return result;
+}
+
+Storage::Storage(const vector<vector<double>>& data) : Storage() {
+    if (data.empty())
+        return;
+    size_t size = data[0].size();
+    for (size_t i = 1; i < data.size(); i++)
+        if (data[i].size() != size)
+            throw runtime_error("Rows have different sizes");
+    *this = Storage(data.size(), size);
+    for (size_t i = 0; i < m_rows; i++)
+        copy(data[i].begin(), data[i].end(), row(i));
+}
+
+Storage::Storage(shared_ptr<double> buffer, size_t rows, size_t cols)   :   m_buffer(buffer)
+                                                                        ,   m_rows(rows)
+                                                                        ,   m_cols(cols)
+                                                                        ,   m_stride(paddedStride(cols)) {}
+
+size_t Storage::rows() const {
+    return m_rows;
+}
+
+size_t Storage::cols() const {
+    return m_cols;
+}
+
+size_t Storage::stride() const {
+    return m_stride;
+}
+
+bool Storage::empty() const {
+    return m_rows == 0 || m_cols == 0;
+}
+
+double* Storage::data() {
+    return m_buffer.get();
+}
+
+const double* Storage::data() const {
+    return m_buffer.get();
+}
+
+double* Storage::row(size_t i) {
+    return m_buffer.get() + i * m_stride;
+}
+
+const double* Storage::row(size_t i) const {
+    return m_buffer.get() + i * m_stride;
+}
+
+double& Storage::operator()(size_t row, size_t col) {
+    return m_buffer.get()[row * m_stride + col];
+}
+
+double Storage::operator()(size_t row, size_t col) const {
+    return m_buffer.get()[row * m_stride + col];
+}
+
+long Storage::owners() const {
+    return m_buffer.use_count();
+}
+
+Storage Storage::clone() const {
+    Storage result(m_rows, m_cols);
+    if (!empty())
+        memcpy(result.data(), data(), m_rows * m_stride * sizeof(double));
+    return result;
+}
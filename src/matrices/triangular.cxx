@@ -1,4 +1,7 @@
 #include "../include/matrix.hxx"
+#include "../include/kernels.hxx"
+#include "../include/lu.hxx"
+#include <algorithm>
 
 using namespace std;
 
@@ -7,47 +10,95 @@ using namespace std;
 TriangularMatrix::TriangularMatrix() : SquareMatrix() {}
 
 TriangularMatrix::TriangularMatrix(const TriangularMatrix& matrix) : SquareMatrix() {
-    m_data.resize(matrix.rows(), vector<double>());
-    for (size_t i = 0; i < matrix.rows(); i++) {
-        m_data[i].resize(matrix.cols() - i);
-        for (size_t j = i; j < matrix.cols(); j++)
-            m_data[i][j - i] = matrix.get(i, j);
-    }
+    // matrices are immutable, the packed buffer can be shared unless the source stores it differently
+    if (matrix.structure() == Structure::UPPER)
+        m_data = matrix.m_data;
+    else
+        pack(matrix);
     m_size = matrix.rows();
     m_empty = false;
 }
 
 TriangularMatrix::TriangularMatrix(const SquareMatrix& matrix) : SquareMatrix() {
-    //each row(vector) is shorter than the previous one by 1
-    m_data.resize(matrix.rows(), vector<double>());
-    for (size_t i = 0; i < matrix.rows(); i++) {
-        m_data[i].resize(matrix.cols() - i);
-        for (size_t j = i; j < matrix.cols(); j++)
-            m_data[i][j - i] = matrix.get(i, j);
-    }
+    //only the upper triangle is copied
+    pack(matrix);
     m_size = matrix.rows();
     m_empty = false;
 }
 
-shared_ptr<Matrix> TriangularMatrix::transform() {
-    if (this->isDiagonal()) {
-        shared_ptr<Matrix> m = make_shared<DiagonalMatrix>(*this);
-        return m->transform();
+TriangularMatrix::TriangularMatrix(const Storage& data) : SquareMatrix() {
+    if (data.rows() != data.cols())
+        throw runtime_error("Non-square matrix");
+    m_size = data.rows();
+    m_data = Storage(1, offset(rows()));
+    for (size_t i = 0; i < rows(); i++)
+        copy(data.row(i) + i, data.row(i) + cols(), m_data.data() + offset(i));
+    m_empty = false;
+}
+
+TriangularMatrix::TriangularMatrix(size_t size, Storage packed) : SquareMatrix() {
+    m_size = size;
+    if (packed.rows() != 1 || packed.cols() != offset(size))
+        throw runtime_error("Packed triangle has wrong size");
+    m_data = packed;
+    m_empty = false;
+}
+
+void TriangularMatrix::pack(const Matrix& matrix) {
+    size_t n = matrix.rows();
+    m_size = n;
+    m_data = Storage(1, offset(n));
+    vector<double> buffer(n);
+    for (size_t i = 0; i < n; i++) {
+        const double* row = matrix.readRow(i, buffer.data());
+        copy(row + i, row + n, m_data.data() + offset(i));
     }
+}
+
+size_t TriangularMatrix::offset(size_t row) const {
+    // rows above hold n, n - 1, ..., n - row + 1 elements
+    return row * rows() - row * (row - 1) / 2;
+}
+
+shared_ptr<Matrix> TriangularMatrix::transform() {
+    if (this->isDiagonal())
+        return DiagonalMatrix(*this).transform();
     return make_shared<TriangularMatrix>(*this);
 }
 
 bool TriangularMatrix::isTriangular() const {
     return true;
 }
+Structure TriangularMatrix::structure() const {
+    return Structure::UPPER;
+}
+
+Layout TriangularMatrix::layout() const {
+    return Layout::UPPER;
+}
+
 bool TriangularMatrix::isDiagonal() const {
-    for (size_t i = 0; i < rows(); i++)
-        for (size_t j = 0; j < cols(); j++)
-            if (i != j && this->get(i, j) != 0)
+    for (size_t i = 0; i < rows(); i++) {
+        const double* row = m_data.data() + offset(i);
+        for (size_t j = 1; j < cols() - i; j++)
+            if (row[j] != 0)
                 return false;
+    }
     return true;
 }
 
+bool TriangularMatrix::isDenseStored() const {
+    return false;
+}
+
+void TriangularMatrix::copyRows(size_t first, size_t last, double* out, size_t ld) const {
+    for (size_t i = first; i < last; i++, out += ld) {
+        const double* row = m_data.data() + offset(i);
+        fill(out, out + i, 0.0);
+        copy(row, row + cols() - i, out + i);
+    }
+}
+
 double TriangularMatrix::get(size_t i, size_t j) const {
     if (i >= rows())
         throw runtime_error("Row index out of range");
@@ -55,5 +106,71 @@ double TriangularMatrix::get(size_t i, size_t j) const {
         throw runtime_error("Column index out of range");
     if (i > j)
         return 0;
-    return m_data[i][j - i];
+    return m_data.data()[offset(i) + j - i];
+}
+
+shared_ptr<Matrix> TriangularMatrix::prod(const shared_ptr<Matrix> rhs) const {
+    if (rhs->structure() != Structure::UPPER || rhs->rows() != this->rows())
+        return Matrix::prod(rhs);
+    // packed operands are unpacked once for the kernel, a square of a matrix only once
+    Storage lhsData = this->dense(), rhsData = rhs.get() == this ? lhsData : rhs->dense();
+    Storage result = Storage::zeros(this->rows(), this->cols());
+    kernels::upperGemm(this->rows(), lhsData.data(), lhsData.stride(), rhsData.data(), rhsData.stride(),
+                       result.data(), result.stride());
+    return classify(result, Structure::UPPER);
+}
+
+shared_ptr<Matrix> TriangularMatrix::power(const shared_ptr<Matrix> rhs) const {
+    unsigned long long n = exponent(rhs);
+    if (n == 0)
+        return make_shared<IdentityMatrix>(this->rows());
+    size_t size = this->rows();
+    auto multiply = [size](const Storage& a, const Storage& b) {
+        Storage c = Storage::zeros(size, size);
+        kernels::upperGemm(size, a.data(), a.stride(), b.data(), b.stride(), c.data(), c.stride());
+        return c;
+    };
+    Storage base = this->dense(), result;
+    while (true) {
+        if (n & 1)
+            result = result.empty() ? base : multiply(result, base);
+        n >>= 1;
+        if (n == 0)
+            break;
+        base = multiply(base, base);
+    }
+    return classify(result, Structure::UPPER);
+}
+
+shared_ptr<Matrix> TriangularMatrix::det() const {
+    double result = 1;
+    for (size_t i = 0; i < rows(); i++)
+        result *= get(i, i);
+    return make_shared<Number>(result);
+}
+
+double TriangularMatrix::tolerance() const {
+    // the identity stores nothing, its diagonal is all there is
+    double largest = 0;
+    for (size_t i = 0; i < rows(); i++)
+        largest = max(largest, fabs(get(i, i)));
+    for (size_t k = 0; k < m_data.cols(); k++)
+        largest = max(largest, fabs(m_data(0, k)));
+    return LU::tolerance(largest, rows());
+}
+
+shared_ptr<Matrix> TriangularMatrix::rank() const {
+    double negligible = tolerance();
+    for (size_t i = 0; i < rows(); i++)
+        if (fabs(get(i, i)) <= negligible)
+            return Matrix::rank();
+    return make_shared<Number>(rows());
+}
+
+shared_ptr<Matrix> TriangularMatrix::gem() const {
+    double negligible = tolerance();
+    for (size_t i = 0; i < rows(); i++)
+        if (fabs(get(i, i)) <= negligible)
+            return Matrix::gem();
+    return make_shared<TriangularMatrix>(*this);
 }
@@ -0,0 +1,137 @@
+#include "../include/matrix.hxx"
+#include "../include/lu.hxx"
+#include "../include/profile.hxx"
+#include <algorithm>
+
+using namespace std;
+
+// INFO: ViewMatrix class implementation
+
+namespace {
+    const size_t TILE = 32; ///< columns gathered at once from a strided view, a tile of rows stays in L1
+
+    // whether classify would keep the elements as a plain Matrix or SquareMatrix: a non-zero element
+    // below the diagonal, anywhere if the matrix is not square, and too many of them to be sparse;
+    // elements are scanned in the order of the buffer and the scan stops as soon as it is decided
+    bool general(const double* data, size_t rows, size_t cols, size_t rowStride, size_t colStride) {
+        size_t limit = SparseMatrix::maxNonzeros(rows, cols), count = 0;
+        bool byRows = rowStride >= colStride, below = false;
+        size_t outer = byRows ? rows : cols, inner = byRows ? cols : rows;
+        size_t outerStride = byRows ? rowStride : colStride, innerStride = byRows ? colStride : rowStride;
+        for (size_t a = 0; a < outer; a++) {
+            const double* line = data + a * outerStride;
+            for (size_t b = 0; b < inner; b++) {
+                if (line[b * innerStride] == 0)
+                    continue;
+                below = below || rows != cols || (byRows ? a > b : b > a);
+                if (++count > limit && below)
+                    return true;
+            }
+        }
+        return false;
+    }
+}
+
+ViewMatrix::ViewMatrix(Storage parent, size_t offset, size_t rows, size_t cols, size_t rowStride, size_t colStride)
+    :   Matrix()
+    ,   m_parent(parent)
+    ,   m_offset(offset)
+    ,   m_rows(rows)
+    ,   m_cols(cols)
+    ,   m_rowStride(rowStride)
+    ,   m_colStride(colStride) {
+    m_empty = false;
+}
+
+ViewMatrix::ViewMatrix(const ViewMatrix& m) :   Matrix(m)
+                                            ,   m_parent(m.m_parent)
+                                            ,   m_offset(m.m_offset)
+                                            ,   m_rows(m.m_rows)
+                                            ,   m_cols(m.m_cols)
+                                            ,   m_rowStride(m.m_rowStride)
+                                            ,   m_colStride(m.m_colStride) {}
+
+shared_ptr<Matrix> ViewMatrix::create(Storage parent, size_t offset, size_t rows, size_t cols, size_t rowStride, size_t colStride) {
+    ViewMatrix view(parent, offset, rows, cols, rowStride, colStride);
+    if (rows * cols >= MIN_ELEMENTS && general(parent.data() + offset, rows, cols, rowStride, colStride))
+        return make_shared<ViewMatrix>(view);
+    return classify(view.dense());
+}
+
+size_t ViewMatrix::rows() const {
+    return m_rows;
+}
+
+size_t ViewMatrix::cols() const {
+    return m_cols;
+}
+
+shared_ptr<Matrix> ViewMatrix::transform() {
+    static profile::Site site("transform");
+    profile::Scope scope(&site);
+    return classify(dense());
+}
+
+bool ViewMatrix::isView() const {
+    return true;
+}
+
+bool ViewMatrix::holdsParentAlone() const {
+    return m_parent.owners() == 1 && m_rows * m_cols < m_parent.rows() * m_parent.cols();
+}
+
+bool ViewMatrix::isDenseStored() const {
+    return false;
+}
+
+void ViewMatrix::copyRows(size_t first, size_t last, double* out, size_t ld) const {
+    const double* data = m_parent.data() + m_offset;
+    if (m_colStride == 1) {
+        for (size_t i = first; i < last; i++, out += ld)
+            copy(data + i * m_rowStride, data + i * m_rowStride + m_cols, out);
+        return;
+    }
+    // columns of the view are rows of the parent, they are gathered a tile at a time
+    for (size_t jb = 0; jb < m_cols; jb += TILE)
+        for (size_t i = first; i < last; i++) {
+            const double* src = data + i * m_rowStride;
+            double* dst = out + (i - first) * ld;
+            for (size_t j = jb; j < min(m_cols, jb + TILE); j++)
+                dst[j] = src[j * m_colStride];
+        }
+}
+
+bool ViewMatrix::strided(const double*& data, size_t& rowStride, size_t& colStride) const {
+    data = m_parent.data() + m_offset;
+    rowStride = m_rowStride;
+    colStride = m_colStride;
+    return true;
+}
+
+double ViewMatrix::get(size_t row, size_t col) const {
+    if (row >= rows())
+        throw runtime_error("Row index out of range");
+    if (col >= cols())
+        throw runtime_error("Column index out of range");
+    return m_parent.data()[m_offset + row * m_rowStride + col * m_colStride];
+}
+
+shared_ptr<Matrix> ViewMatrix::power(const shared_ptr<Matrix> rhs) const {
+    if (!isSquare())
+        return Matrix::power(rhs);
+    return SquareMatrix(dense()).power(rhs);
+}
+
+shared_ptr<Matrix> ViewMatrix::transpose() const {
+    return create(m_parent, m_offset, m_cols, m_rows, m_colStride, m_rowStride);
+}
+
+shared_ptr<Matrix> ViewMatrix::det() const {
+    if (!isSquare())
+        return Matrix::det();
+    return make_shared<Number>(factorization()->det());
+}
+
+shared_ptr<Matrix> ViewMatrix::region(size_t top, size_t left, size_t rows, size_t cols) const {
+    return create(m_parent, m_offset + top * m_rowStride + left * m_colStride, rows, cols, m_rowStride, m_colStride);
+}
@@ -1,4 +1,5 @@
 #include "../include/matrix.hxx"
+#include <algorithm>
 
 using namespace std;
 
@@ -35,6 +36,23 @@ bool ZeroMatrix::isZero() const {
     return true;
 }
 
+Structure ZeroMatrix::structure() const {
+    return rows() == cols() ? Structure::DIAGONAL : Structure::GENERAL;
+}
+
+Layout ZeroMatrix::layout() const {
+    return Layout::ZERO;
+}
+
+bool ZeroMatrix::isDenseStored() const {
+    return false;
+}
+
+void ZeroMatrix::copyRows(size_t first, size_t last, double* out, size_t ld) const {
+    for (size_t i = first; i < last; i++, out += ld)
+        fill(out, out + cols(), 0.0);
+}
+
 double ZeroMatrix::get(size_t row, size_t col) const {
     if (row >= rows())
         throw runtime_error("Row index out of range");
@@ -44,13 +62,12 @@ double ZeroMatrix::get(size_t row, size_t col) const {
 }
 
 shared_ptr<Matrix> ZeroMatrix::add(const shared_ptr<Matrix> rhs) const {
-    shared_ptr<Matrix> m;
     if (rows() != rhs->rows())
         throw runtime_error("Different number of rows");
     if (cols() != rhs->cols())
         throw runtime_error("Different number of columns");
-    m = make_shared<Matrix>(*rhs);
-    return m->transform();
+    // matrices are immutable, the sum is rhs itself
+    return rhs;
 }
 
 shared_ptr<Matrix> ZeroMatrix::sub(const shared_ptr<Matrix> rhs) const {
@@ -64,17 +81,17 @@ shared_ptr<Matrix> ZeroMatrix::sub(const shared_ptr<Matrix> rhs) const {
 shared_ptr<Matrix> ZeroMatrix::prod(const shared_ptr<Matrix> rhs) const {
     if (rhs->isNumber())
         return make_shared<ZeroMatrix>(rows(), cols());
-    if (rows() != rhs->rows())
-        throw runtime_error("Different number of rows");
-    if (cols() != rhs->cols())
-        throw runtime_error("Different number of columns");
+    if (cols() != rhs->rows())
+        throw runtime_error("Different number of colum");
+    if (rows() == 1 && rhs->cols() == 1)
+        return make_shared<Number>(0);
     return make_shared<ZeroMatrix>(rows(), rhs->cols());
 }
 
 shared_ptr<Matrix> ZeroMatrix::div(const shared_ptr<Matrix> rhs) const {
     if (!rhs->isNumber())
         throw runtime_error("Division by non-number");
-    if (rhs == 0)
+    if (rhs->number() == 0)
         throw runtime_error("Division by zero");
     return make_shared<ZeroMatrix>(rows(), cols());
 }
@@ -82,7 +99,7 @@ shared_ptr<Matrix> ZeroMatrix::div(const shared_ptr<Matrix> rhs) const {
 shared_ptr<Matrix> ZeroMatrix::power(const shared_ptr<Matrix> rhs) const {
     if (rows() != cols())
         throw runtime_error("Non-square matrix");
-    if (rhs == 0)
+    if (exponent(rhs) == 0)
         return make_shared<IdentityMatrix>(rows());
     return make_shared<ZeroMatrix>(rows(), cols());
 }
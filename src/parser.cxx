@@ -1,57 +1,255 @@
 #include "include/parser.hxx"
+#include "include/threadpool.hxx"
+#include "include/binary.hxx"
+#include "include/profile.hxx"
+#include "include/text.hxx"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <ctime>
+#include <iomanip>
 
 using namespace std;
 
 //Implementation of Parser
 
+namespace {
+    const string TEXT_EXTENSION = ".matix";
+    const string BINARY_EXTENSION = ".matb";
+    const size_t REPORT_BYTES = 1 << 20; ///< throughput of loading smaller text files is not reported
+
+    bool hasExtension(const string& name, const string& extension) {
+        return name.size() > extension.size() && name.compare(name.size() - extension.size(), extension.size(), extension) == 0;
+    }
+
+    // name of the variable stored in a file, a known extension is dropped
+    string variableName(const string& name) {
+        if (hasExtension(name, TEXT_EXTENSION))
+            return name.substr(0, name.size() - TEXT_EXTENSION.size());
+        if (hasExtension(name, BINARY_EXTENSION))
+            return name.substr(0, name.size() - BINARY_EXTENSION.size());
+        return name;
+    }
+
+    // site of a cached operation, named like the method of Matrix doing it
+    profile::Site* operationSite(const string& op) {
+        if (op == "!")
+            return profile::site("transpose");
+        if (op == "*")
+            return profile::site("prod");
+        if (op == "^")
+            return profile::site("power");
+        return profile::site(op);
+    }
+
+    // factorizations are not reused while it exists
+    struct FreshFactorizations {
+        FreshFactorizations() {
+            Matrix::reuseFactorizations(false);
+        }
+        ~FreshFactorizations() {
+            Matrix::reuseFactorizations(true);
+        }
+    };
+
+    double millisecondsSince(chrono::steady_clock::time_point start) {
+        return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    }
+
+    string describe(const Matrix& m) {
+        return m.whoami() + " " + to_string(m.rows()) + "x" + to_string(m.cols());
+    }
+}
+
 //Constructor
-Parser::Parser(string workingDirectory, ostream& os, istream& is) : m_workingDirectory(workingDirectory), m_os(os), m_is(is), m_matrices(), m_lexer(is), m_running(true) {}
+Parser::Parser(string workingDirectory, ostream& os, istream& is) : m_workingDirectory(workingDirectory), m_os(os), m_is(is), m_matrices(), m_lexer(is), m_cache(make_shared<ResultCache>()), m_running(true) {}
 
 //Public methods
 void Parser::run() {
-    shared_ptr<Matrix>  m;
     while (m_running) {
         m_os << m_workingDirectory << "> ";
         m_lexer.getInput();
         try {
-            m = parse();
-            if (m_lexer.getCurrentToken() != "") 
-                throw invalid_argument("Ignored from '" + m_lexer.getCurrentToken() + "'");
-            if (m != nullptr) {
-                m_os << m->whoami() << endl;
-                m_os << m->toString();
-            }
+            execute();
         }
         catch (exception& e) {
             m_os << e.what() << endl;
         }
+        releaseViews();
     } 
 }
 
+int Parser::runScript(ostream& errors) {
+    // statements are placed on levels, a statement runs after all levels of statements it depends on
+    vector<Statement> statements;
+    map<string, size_t, less<> > written, read, saved; // level after the last writer, readers and saver
+    size_t floor = 0, top = 0; // lowest level of the next statement, one past the highest level used
+    string line;
+    for (size_t number = 1; getline(m_is, line); number++) {
+        if (line.find_first_not_of(" \t\r\v\f") == string::npos)
+            continue;
+        Statement s = analyze(line);
+        s.line = number;
+        if (s.exit)
+            break;
+        s.level = s.barrier || s.ordered ? top : floor;
+        for (const string& name : s.reads)
+            s.level = max(s.level, written[name]);
+        for (const string& name : s.writes)
+            s.level = max({s.level, written[name], read[name]});
+        for (const string& name : s.loads)
+            s.level = max(s.level, saved[name]);
+        for (const string& name : s.reads)
+            read[name] = max(read[name], s.level);
+        for (const string& name : s.writes)
+            written[name] = s.level + 1;
+        for (const string& name : s.saves)
+            saved[name] = s.level + 1;
+        if (s.barrier)
+            floor = s.level + 1;
+        top = max(top, s.level + 1);
+        statements.push_back(move(s));
+    }
+
+    vector<vector<size_t>> levels(top);
+    for (size_t i = 0; i < statements.size(); i++)
+        levels[statements[i].level].push_back(i);
+    vector<string> output(statements.size()), error(statements.size());
+    vector<shared_ptr<Parser>> done(statements.size());
+    size_t stop = statements.size(), flushed = 0; // first failed statement, first statement not written yet
+    for (size_t l = 0; l < levels.size(); l++) {
+        // statements after a failed one are not started, earlier ones still run
+        vector<size_t> runnable;
+        for (size_t i : levels[l])
+            if (i < stop)
+                runnable.push_back(i);
+        ThreadPool::instance().parallelFor(0, runnable.size(), 1, [&](size_t lo, size_t hi) {
+            for (size_t k = lo; k < hi; k++) {
+                size_t i = runnable[k];
+                stringstream input(statements[i].text), os;
+                auto worker = make_shared<Parser>(m_workingDirectory, os, input);
+                worker->m_cache = m_cache;
+                for (const string& name : statements[i].reads) {
+                    auto variable = m_matrices.find(name);
+                    if (variable != m_matrices.end())
+                        worker->m_matrices.insert(*variable);
+                }
+                worker->m_lexer.getInput();
+                try {
+                    worker->execute();
+                    done[i] = worker;
+                } catch (exception& e) {
+                    error[i] = e.what();
+                }
+                output[i] = os.str();
+            }
+        });
+        // variables are stored in the order of the script, none of them is written twice on a level,
+        // statements after a failed one are discarded as if they had not run
+        for (size_t i : runnable)
+            if (done[i] == nullptr)
+                stop = min(stop, i);
+        for (size_t i : runnable) {
+            if (i < stop)
+                for (const string& name : statements[i].writes)
+                    store(name, done[i]->m_matrices.at(name));
+            done[i] = nullptr;
+        }
+        releaseViews();
+        // output is written in the order of the script, up to the first statement which did not run yet
+        for (; flushed < stop && statements[flushed].level <= l; flushed++)
+            m_os << output[flushed];
+        m_os.flush();
+    }
+    if (stop == statements.size())
+        return 0;
+    m_os << output[stop];
+    m_os.flush();
+    errors << "Line " << statements[stop].line << ": " << error[stop] << endl;
+    return 1;
+}
+
+void Parser::execute() {
+    static profile::Site statement("statement"), print("print");
+    // temporaries released before the statement ends leave their buffers to later ones
+    Storage::Pool pool;
+    shared_ptr<Matrix> m;
+    {
+        profile::Scope scope(&statement);
+        m = parse();
+    }
+    if (m_lexer.current().kind != TokenKind::END)
+        throw invalid_argument("Ignored from '" + string(m_lexer.getCurrentToken()) + "'");
+    if (m != nullptr) {
+        profile::Scope scope(&print);
+        m_os << m->whoami() << endl;
+        m_os << m->toString();
+    }
+}
+
+Parser::Statement Parser::analyze(const string& line) {
+    static const set<string, less<> > OPERATIONS = {"rank", "gem", "det", "inv", "solve", "float32", "float64"};
+    Statement s;
+    s.text = line;
+    stringstream input(line);
+    Lexer lexer(input);
+    lexer.getInput();
+    string_view first = lexer.getNextToken();
+    if (first == "exit") {
+        s.exit = true;
+    } else if (first == "load" || first == "save") {
+        // files of one variable are told apart by extension only, both count as the same file
+        string name = variableName(string(lexer.getNextToken()));
+        if (first == "load") {
+            s.writes.insert(name);
+            s.loads.insert(name);
+        } else {
+            s.reads.insert(name);
+            s.saves.insert(name);
+            s.ordered = true;
+        }
+    } else if (first == "threads" || first == "cache" || first == "stats") {
+        s.barrier = true;
+    } else {
+        // timed statements run alone, so other statements do not slow them down
+        if (first == "time" || first == "bench") {
+            s.barrier = true;
+            lexer.getNextToken();
+        } else if (lexer.peekToken() == "=") {
+            s.writes.insert(string(first));
+            lexer.getNextToken();
+            lexer.getNextToken();
+        }
+        // every other name is a variable, an unknown one fails when the statement runs
+        for (; lexer.current().kind != TokenKind::END; lexer.getNextToken())
+            if (lexer.current().kind == TokenKind::IDENTIFIER && OPERATIONS.count(lexer.getCurrentToken()) == 0)
+                s.reads.insert(string(lexer.getCurrentToken()));
+    }
+    return s;
+}
+
 shared_ptr<Matrix>  Parser::parse() {
     m_lexer.getNextToken();
     return parseAssign();
 }
 
 //Private methods
-shared_ptr<Matrix>  Parser::parseRow() {
-    // vector of doubles
-    vector<double> row;
-    while(true){
-    // try to convert current token to double exit loop if fail
-        try {
-            row.push_back(stod(m_lexer.getCurrentToken()));
-        } catch (invalid_argument& e) {
-            break;
-        }
+size_t Parser::parseRow(vector<double>& elements) {
+    size_t count = 0;
+    // numbers were parsed by the lexer, the row ends at the first other token
+    while (m_lexer.current().kind == TokenKind::NUMBER) {
+        elements.push_back(m_lexer.current().number);
+        count++;
         m_lexer.getNextToken();
     }
-    // create matrix from vector
-    return make_shared<Matrix>(vector<vector<double>>({row}));
+    return count;
 }
 
 shared_ptr<Matrix>  Parser::parseMatrix() {
-    shared_ptr<Matrix> m, t1, t2;
+    // elements of all rows one after another, copied into the matrix once its size is known
+    vector<double> elements;
+    size_t rows = 1, cols;
     // check that current token is '['
     if (m_lexer.getCurrentToken() != "[") {
         throw invalid_argument("Expected '['");
@@ -63,16 +261,16 @@ shared_ptr<Matrix>  Parser::parseMatrix() {
         return make_shared<Matrix>();
     }
     // parse first row
-    m = parseRow();
+    cols = parseRow(elements);
     // check that row is not empty
-    if (m->isEmpty())
+    if (cols == 0)
         throw invalid_argument("Empty row");
     // parse next rows
     while (m_lexer.getCurrentToken() == "&") {
         m_lexer.getNextToken();
-        t1 = m;
-        t2 = parseRow();
-        m = t1->vconcat(t2);
+        if (parseRow(elements) != cols)
+            throw runtime_error("Different number of columns");
+        rows++;
     }
     // check that current token is ']'
     if (m_lexer.getCurrentToken() != "]") {
@@ -80,139 +278,165 @@ shared_ptr<Matrix>  Parser::parseMatrix() {
     }
     m_lexer.getNextToken();
 
-    return m->transform();
+    Storage data(rows, cols);
+    for (size_t i = 0; i < rows; i++)
+        copy(elements.begin() + i * cols, elements.begin() + (i + 1) * cols, data.row(i));
+    return Matrix::classify(data);
 }
 
-shared_ptr<Matrix>  Parser::parseUnary() {
-    shared_ptr<Matrix> m, t;
-    // check if current token is ! , - , h or k
+shared_ptr<Expression> Parser::parseUnary() {
+    shared_ptr<Expression> t;
+    // check if current token is ! , - or one of the named operations
     if (m_lexer.getCurrentToken() == "!") {
         m_lexer.getNextToken();
-        t = parseUnary();
-        m = t->transpose();
-        return m;
+        shared_ptr<Matrix> a = parseUnary()->evaluate();
+        return cached("!", a, nullptr, [&] { return a->transpose(); });
     } else if (m_lexer.getCurrentToken() == "-") {
         m_lexer.getNextToken();
         t = parseUnary();
-        m = t->neg();
-        return m;
+        return Expression::neg(t);
     } else if (m_lexer.getCurrentToken() == "rank") {
         m_lexer.getNextToken();
-        t = parseUnary();
-        m = t->rank();
-        return m;
+        shared_ptr<Matrix> a = parseUnary()->evaluate();
+        return cached("rank", a, nullptr, [&] { return a->rank(); });
     } else if (m_lexer.getCurrentToken() == "gem") {
         m_lexer.getNextToken();
-        t = parseUnary();
-        m = t->gem();
-        return m;
+        shared_ptr<Matrix> a = parseUnary()->evaluate();
+        return cached("gem", a, nullptr, [&] { return a->gem(); });
     } else if (m_lexer.getCurrentToken() == "det") {
         m_lexer.getNextToken();
-        t = parseUnary();
-        m = t->det();
-        return m;
+        shared_ptr<Matrix> a = parseUnary()->evaluate();
+        return cached("det", a, nullptr, [&] { return a->det(); });
+    } else if (m_lexer.getCurrentToken() == "inv") {
+        m_lexer.getNextToken();
+        shared_ptr<Matrix> a = parseUnary()->evaluate();
+        return cached("inv", a, nullptr, [&] { return a->inv(); });
+    } else if (m_lexer.getCurrentToken() == "solve") {
+        // solve A B finds X such that A * X = B
+        m_lexer.getNextToken();
+        shared_ptr<Matrix> a = parseUnary()->evaluate();
+        shared_ptr<Matrix> b = parseUnary()->evaluate();
+        return cached("solve", a, b, [&] { return a->solve(b); });
+    } else if (m_lexer.getCurrentToken() == "float32" || m_lexer.getCurrentToken() == "float64") {
+        // precision in which the elements are kept, computations are always done in double
+        bool single = m_lexer.getCurrentToken() == "float32";
+        m_lexer.getNextToken();
+        shared_ptr<Matrix> a = parseUnary()->evaluate();
+        return Expression::value(single ? FloatMatrix::narrow(a) : FloatMatrix::widen(a));
     }
     // if current token is parenthesis parse expression inside(from the beginning)
+    // the inner expression stays unevaluated so it can be fused with the outer one
     else if (m_lexer.getCurrentToken() == "(") {
         m_lexer.getNextToken();
-        m = parseAddSub();
+        t = parseAddSub();
         if (m_lexer.getCurrentToken() != ")") {
-            throw invalid_argument("Expected ')'" + m_lexer.getCurrentToken());
+            throw invalid_argument("Expected ')'" + string(m_lexer.getCurrentToken()));
         }
         m_lexer.getNextToken();
-        return m;
+        return t;
     }
     // if token is [ parse Matrix
     if (m_lexer.getCurrentToken() == "[") {
-        return parseMatrix();
+        return Expression::value(parseMatrix());
     }
-    // if can convert token to double return make_shared<Number> 
-    try {
-        m = make_shared<Number>(stod(m_lexer.getCurrentToken()));
+    // if token is a number return make_shared<Number>
+    if (m_lexer.current().kind == TokenKind::NUMBER) {
+        t = Expression::value(make_shared<Number>(m_lexer.current().number));
         m_lexer.getNextToken();
-        return m;
-    } catch (invalid_argument&) {
-        // if token is not a number check if it is a variable
-        if (m_matrices.find(m_lexer.getCurrentToken()) != m_matrices.end()) {
-            m = m_matrices.at(m_lexer.getCurrentToken());
-            m_lexer.getNextToken();
-            return m;
-        }
-        else {
-            throw invalid_argument("Semantic error at '" + m_lexer.getCurrentToken() + "'");
-        }
+        return t;
     }
+    // if token is not a number check if it is a variable
+    auto variable = m_matrices.find(m_lexer.getCurrentToken());
+    if (variable == m_matrices.end())
+        throw invalid_argument("Semantic error at '" + string(m_lexer.getCurrentToken()) + "'");
+    t = Expression::value(variable->second);
+    m_lexer.getNextToken();
+    return t;
 }
 
-shared_ptr<Matrix>  Parser::parseBackslash() {
-    shared_ptr<Matrix> m, t1, t2;
+shared_ptr<Expression> Parser::parseBackslash() {
+    shared_ptr<Expression> m, t1, t2;
     m = parseUnary();
     if (m_lexer.getCurrentToken() == "\\") {
         m_lexer.getNextToken();
         t1 = m;
         t2 = parseBackslash();
-        m = t1->crop(t2);
+        shared_ptr<Matrix> a = t1->evaluate(), b = t2->evaluate();
+        static profile::Site site("crop");
+        profile::Scope scope(&site);
+        m = Expression::value(a->crop(b));
     }
     return m;
 }
 // parse ^ operations
-shared_ptr<Matrix>  Parser::parsePower() {
-    shared_ptr<Matrix> m, t1, t2;
+shared_ptr<Expression> Parser::parsePower() {
+    shared_ptr<Expression> m;
     m = parseBackslash();
     if (m_lexer.getCurrentToken() == "^") {
         m_lexer.getNextToken();
-        t1 = m;
-        t2 = parsePower();
-        m = t1->power(t2);
+        shared_ptr<Expression> t = parsePower();
+        shared_ptr<Matrix> a = m->evaluate(), b = t->evaluate();
+        m = cached("^", a, b, [&] { return a->power(b); });
     }
     return m;
 }
 
-shared_ptr<Matrix>  Parser::parseOr() {
-    shared_ptr<Matrix> m, t1, t2;
+shared_ptr<Expression> Parser::parseOr() {
+    shared_ptr<Expression> m, t1, t2;
     m = parsePower();
     if (m_lexer.getCurrentToken() == "|") {
         m_lexer.getNextToken();
         t1 = m;
         t2 = parseOr();
-        m = t1->hconcat(t2);
+        shared_ptr<Matrix> a = t1->evaluate(), b = t2->evaluate();
+        static profile::Site site("hconcat");
+        profile::Scope scope(&site);
+        m = Expression::value(BlockMatrix::hconcat(a, b));
     }
     return m;
 }
 
-shared_ptr<Matrix>  Parser::parseAnd() {
-    shared_ptr<Matrix> m, t1, t2;
+shared_ptr<Expression> Parser::parseAnd() {
+    shared_ptr<Expression> m, t1, t2;
     m = parseOr();
     if (m_lexer.getCurrentToken() == "&") {
         m_lexer.getNextToken();
         t1 = m;
         t2 = parseAnd();
-        m = t1->vconcat(t2);
+        shared_ptr<Matrix> a = t1->evaluate(), b = t2->evaluate();
+        static profile::Site site("vconcat");
+        profile::Scope scope(&site);
+        m = Expression::value(BlockMatrix::vconcat(a, b));
     }
     return m;
 }
 
-shared_ptr<Matrix>  Parser::parseMulDiv() {
-    shared_ptr<Matrix> m, t1, t2;
-    string op;
+// products and sums only build the expression tree, element-wise chains are evaluated in one pass
+shared_ptr<Expression> Parser::parseMulDiv() {
+    shared_ptr<Expression> m, t1, t2;
+    string_view op;
     m = parseAnd();
     while (m_lexer.getCurrentToken() == "*" || m_lexer.getCurrentToken() == "/") {
         op = m_lexer.getCurrentToken();
         m_lexer.getNextToken();
         t1 = m;
             t2 = parseOr();
-        if (op == "*") {
-                m = t1->prod(t2);
+        // products of two matrices are evaluated right away, their results are cached
+        if (op == "*" && !t2->isNumber()) {
+                shared_ptr<Matrix> a = t1->evaluate(), b = t2->evaluate();
+                m = cached("*", a, b, [&] { return a->prod(b); });
+        } else if (op == "*") {
+                m = Expression::prod(t1, t2);
         } else {
-                m = t1->div(t2);
+                m = Expression::div(t1, t2);
         }
     }
     return m;
 }
 
-shared_ptr<Matrix>  Parser::parseAddSub() {
-    shared_ptr<Matrix> m, t1, t2;
-    string op;
+shared_ptr<Expression> Parser::parseAddSub() {
+    shared_ptr<Expression> m, t1, t2;
+    string_view op;
     m = parseMulDiv();
     while (m_lexer.getCurrentToken() == "+" || m_lexer.getCurrentToken() == "-") {
         op = m_lexer.getCurrentToken();
@@ -220,9 +444,9 @@ shared_ptr<Matrix>  Parser::parseAddSub() {
         t1 = m;
         t2 = parseMulDiv();
         if (op == "+") {
-            m = t1->add(t2);
+            m = Expression::add(t1, t2);
         } else {
-            m = t1->sub(t2);
+            m = Expression::sub(t1, t2);
         }
     }
     return m;
@@ -236,59 +460,232 @@ shared_ptr<Matrix>  Parser::parseAssign() {
         return nullptr;
     } else
     if (m_lexer.getCurrentToken() == "load") {
-        string name = m_lexer.getNextToken();
+        string name(m_lexer.getNextToken());
         shared_ptr<Matrix> m = readFromFile(name);
-        m = m->transform();
-        m_matrices[name] = m;
-        m_lexer.getNextToken();
+        // optional precision of the loaded elements
+        string_view precision = m_lexer.getNextToken();
+        if (precision == "float32" || precision == "float64") {
+            m = precision == "float32" ? FloatMatrix::narrow(m) : FloatMatrix::widen(m);
+            m_lexer.getNextToken();
+        }
+        store(variableName(name), m);
         return nullptr;
     } else
     if (m_lexer.getCurrentToken() == "save") {
-        string name = m_lexer.getNextToken();
-        if (m_matrices.find(name) == m_matrices.end()) {
-            throw invalid_argument("Matrix '" + name + "' not found");
+        string name(m_lexer.getNextToken());
+        if (m_matrices.find(variableName(name)) == m_matrices.end()) {
+            throw invalid_argument("Matrix '" + variableName(name) + "' not found");
+        }
+        writeToFile(name, m_matrices.at(variableName(name)));
+        m_lexer.getNextToken();
+        return nullptr;
+    } else
+    if (m_lexer.getCurrentToken() == "threads") {
+        m_lexer.getNextToken();
+        const Token& count = m_lexer.current();
+        if (count.kind == TokenKind::END)
+            return make_shared<Number>(ThreadPool::instance().size());
+        double n = 0;
+        if (count.kind == TokenKind::NUMBER && modf(count.number, &n) != 0)
+            n = 0;
+        if (n < 1 || n > ThreadPool::maxThreads())
+            throw invalid_argument("Invalid number of threads '" + string(count.text) + "'");
+        ThreadPool::instance().resize(n);
+        m_lexer.getNextToken();
+        return nullptr;
+    } else
+    if (m_lexer.getCurrentToken() == "cache") {
+        m_lexer.getNextToken();
+        const Token& budget = m_lexer.current();
+        if (budget.kind == TokenKind::END) {
+            ResultCache::Stats stats = m_cache->stats();
+            stringstream report;
+            report << fixed << setprecision(1) << "Cache: " << stats.hits << " hits, " << stats.misses << " misses, "
+                   << stats.evictions << " evictions, " << stats.entries << " entries, "
+                   << stats.bytes / 1e6 << " of " << m_cache->budget() / 1e6 << " MB";
+            m_os << report.str() << endl;
+            return nullptr;
+        }
+        // budget in MB, zero turns the cache off
+        if (budget.kind != TokenKind::NUMBER || budget.number < 0)
+            throw invalid_argument("Invalid cache size '" + string(budget.text) + "'");
+        m_cache->setBudget(budget.number * 1e6);
+        m_lexer.getNextToken();
+        return nullptr;
+    } else
+    if (m_lexer.getCurrentToken() == "stats") {
+        string_view command = m_lexer.getNextToken();
+        if (command.empty()) {
+            profile::report(m_os);
+            return nullptr;
+        }
+        if (command == "on" || command == "off") {
+            profile::enable(command == "on");
+        } else if (command == "reset") {
+            profile::reset();
+        } else if (command == "trace") {
+            string file(m_lexer.getNextToken());
+            if (file.empty())
+                throw invalid_argument("Missing trace file");
+            if (file == "off")
+                profile::stopTrace();
+            else
+                profile::trace(m_workingDirectory + "/" + file);
+        } else {
+            throw invalid_argument("Unknown stats command '" + string(command) + "'");
         }
-        writeToFile(name, m_matrices.at(name));
         m_lexer.getNextToken();
         return nullptr;
     } else
+    if (m_lexer.getCurrentToken() == "time") {
+        return parseTime();
+    } else
+    if (m_lexer.getCurrentToken() == "bench") {
+        return parseBench();
+    } else
     if (m_lexer.peekToken() == "=") {
-        string name = m_lexer.getCurrentToken();
+        string name(m_lexer.getCurrentToken());
         m_lexer.getNextToken();
         m_lexer.getNextToken();
-        shared_ptr<Matrix>  m = parseAddSub();
-        m_matrices[name] = m;
+        shared_ptr<Matrix>  m = parseAddSub()->evaluate();
+        store(name, m);
         return nullptr;
     } else {
-        return parseAddSub();
+        return parseAddSub()->evaluate();
+    }
+}
+
+shared_ptr<Matrix>  Parser::parseTime() {
+    m_lexer.getNextToken();
+    profile::resetPeak();
+    uint64_t before = profile::liveBytes();
+    clock_t cpu = clock();
+    auto start = chrono::steady_clock::now();
+    shared_ptr<Matrix> m = parseAddSub()->evaluate();
+    double wall = millisecondsSince(start);
+    double cpuTime = 1e3 * (clock() - cpu) / CLOCKS_PER_SEC;
+    uint64_t peak = profile::peakBytes() - before;
+    // formatted apart, precision of m_os is kept for matrices
+    stringstream report;
+    report << fixed << setprecision(3) << describe(*m) << ": wall " << wall << " ms, cpu " << cpuTime << " ms, peak "
+           << setprecision(1) << peak / 1e6 << " MB";
+    m_os << report.str() << endl;
+    return nullptr;
+}
+
+shared_ptr<Matrix>  Parser::parseBench() {
+    m_lexer.getNextToken();
+    const Token& count = m_lexer.current();
+    double n = 0;
+    if (count.kind == TokenKind::NUMBER && modf(count.number, &n) != 0)
+        n = 0;
+    if (n < 1)
+        throw invalid_argument("Invalid number of runs '" + string(count.text) + "'");
+    m_lexer.getNextToken();
+    string text(m_lexer.rest());
+    if (text.empty())
+        throw invalid_argument("Missing expression");
+    while (m_lexer.current().kind != TokenKind::END)
+        m_lexer.getNextToken();
+
+    FreshFactorizations fresh;
+    vector<double> times;
+    shared_ptr<Matrix> m;
+    for (size_t run = 0; run < n; run++) {
+        // every run parses the line again with a parser of its own, so no result is kept between runs
+        stringstream input(text);
+        Parser parser(m_workingDirectory, m_os, input);
+        parser.m_matrices = m_matrices;
+        parser.m_cache->setBudget(0);
+        parser.m_lexer.getInput();
+        parser.m_lexer.getNextToken();
+        m = nullptr;
+        auto start = chrono::steady_clock::now();
+        m = parser.parseAddSub()->evaluate();
+        times.push_back(millisecondsSince(start));
+        if (parser.m_lexer.current().kind != TokenKind::END)
+            throw invalid_argument("Ignored from '" + string(parser.m_lexer.getCurrentToken()) + "'");
     }
+    sort(times.begin(), times.end());
+    stringstream report;
+    report << fixed << setprecision(3) << describe(*m) << ", " << times.size() << " runs: min " << times.front()
+           << " ms, median " << times[times.size() / 2] << " ms, p99 " << times[size_t(ceil(0.99 * times.size())) - 1] << " ms";
+    m_os << report.str() << endl;
+    return nullptr;
 }
 
 shared_ptr<Matrix>  Parser::readFromFile(string filename) {
-    ifstream file(m_workingDirectory + "/" + filename + ".matix");
-    if (!file.is_open()) {
-        throw invalid_argument("File '" + filename + ".matix' not found");
+    static profile::Site site("load");
+    profile::Scope scope(&site);
+    // without an extension a binary file is preferred to a text one
+    if (variableName(filename) == filename) {
+        bool binary = ifstream(m_workingDirectory + "/" + filename + BINARY_EXTENSION).good();
+        filename += binary ? BINARY_EXTENSION : TEXT_EXTENSION;
     }
-    string line;
-    vector<vector<double>> data;
-    while (getline(file, line)) {
-        vector<double> row;
-        stringstream ss(line);
-        double d;
-        while (ss >> d) {
-            row.push_back(d);
-        }
-        data.push_back(row);
+    string path = m_workingDirectory + "/" + filename;
+    // the format is told by the content, not by the extension
+    if (binary::detect(path))
+        return binary::load(path);
+    if (!ifstream(path).is_open()) {
+        throw invalid_argument("File '" + filename + "' not found");
+    }
+    text::Throughput throughput;
+    shared_ptr<Matrix> m = text::load(path, throughput);
+    if (throughput.bytes >= REPORT_BYTES) {
+        // formatted apart, precision of m_os is kept for matrices
+        stringstream report;
+        report << fixed << setprecision(1) << "Parsed " << throughput.bytes / 1e6 << " MB in "
+               << setprecision(3) << throughput.seconds << " s (" << setprecision(1) << throughput.megabytesPerSecond() << " MB/s)";
+        m_os << report.str() << endl;
     }
-    file.close();
-    return make_shared<Matrix>(data)->transform();
+    return m;
 }
 
 void Parser::writeToFile(string filename, shared_ptr<Matrix> matrix) {
-    ofstream file(m_workingDirectory + "/" + filename + ".matix");
+    static profile::Site site("save");
+    profile::Scope scope(&site);
+    // text only on request, binary files are smaller and load without parsing
+    bool readable = hasExtension(filename, TEXT_EXTENSION);
+    if (variableName(filename) == filename)
+        filename += BINARY_EXTENSION;
+    // truncating the target would pull the elements from under a matrix mapped from it
+    string path = m_workingDirectory + "/" + filename, temporary = path + ".tmp";
+    ofstream file(temporary, readable ? ios::out : ios::out | ios::binary);
     if (!file.is_open()) {
-        throw invalid_argument("Cannot write to file '" + filename + ".matix'");
+        throw invalid_argument("Cannot write to file '" + filename + "'");
+    }
+    try {
+        if (readable)
+            matrix->print(file);
+        else
+            binary::save(file, *matrix);
+        file.close();
+        if (!file || rename(temporary.c_str(), path.c_str()) != 0)
+            throw invalid_argument("Cannot write to file '" + filename + "'");
+    } catch (...) {
+        remove(temporary.c_str());
+        throw;
     }
-    file << matrix->toString();
-    file.close();
+}
+
+shared_ptr<Expression> Parser::cached(const string& op, const shared_ptr<Matrix>& lhs, const shared_ptr<Matrix>& rhs,
+                                      const function<shared_ptr<Matrix>()>& compute) {
+    // only computed results are counted, hits show in the statistics of the cache
+    return Expression::value(m_cache->get(op, lhs, rhs, [&] {
+        profile::Scope scope(operationSite(op));
+        return compute();
+    }));
+}
+
+void Parser::store(const string& name, shared_ptr<Matrix> matrix) {
+    auto variable = m_matrices.find(name);
+    if (variable != m_matrices.end())
+        m_cache->invalidate(variable->second);
+    m_matrices[name] = matrix;
+}
+
+void Parser::releaseViews() {
+    for (auto& variable : m_matrices)
+        if (variable.second->isView() && static_cast<const ViewMatrix&>(*variable.second).holdsParentAlone())
+            variable.second = variable.second->transform();
 }
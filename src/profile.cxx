@@ -0,0 +1,239 @@
+#include "include/profile.hxx"
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// Implementation of profile
+
+atomic<bool> profile::active(getenv("MTRX_PROFILE") != nullptr || getenv("MTRX_TRACE") != nullptr);
+
+namespace {
+    // one complete event of the Chrome trace format
+    struct Event {
+        const char* name;
+        uint64_t start;     ///< nanoseconds since the trace started
+        uint64_t duration;  ///< nanoseconds
+        size_t thread;
+    };
+
+    struct Registry;
+    void writeTrace(Registry& r);
+
+    struct Registry {
+        recursive_mutex lock; ///< sites register themselves while profile::site holds it
+        vector<profile::Site*> sites;
+        map<string, unique_ptr<profile::Site>> named; ///< sites created by profile::site
+        mutex traceLock;
+        atomic<bool> tracing{false};
+        string tracePath;
+        chrono::steady_clock::time_point traceStart;
+        vector<Event> events;
+
+        // the trace of a session is written when the program exits
+        ~Registry() {
+            try {
+                writeTrace(*this);
+            } catch (exception&) {}
+        }
+    };
+
+    Registry& registry() {
+        static Registry instance;
+        return instance;
+    }
+
+    // small number of the calling thread for trace events
+    size_t threadNumber() {
+        static atomic<size_t> next{0};
+        thread_local size_t number = next++;
+        return number;
+    }
+
+    void writeTrace(Registry& r) {
+        if (!r.tracing.exchange(false))
+            return;
+        lock_guard<mutex> guard(r.traceLock);
+        ofstream file(r.tracePath);
+        file << "{\"traceEvents\": [\n";
+        file << fixed << setprecision(3);
+        for (size_t i = 0; i < r.events.size(); i++) {
+            const Event& e = r.events[i];
+            file << "  {\"name\": \"" << e.name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << e.thread
+                 << ", \"ts\": " << e.start / 1e3 << ", \"dur\": " << e.duration / 1e3 << "}"
+                 << (i + 1 < r.events.size() ? ",\n" : "\n");
+        }
+        file << "]}\n";
+        r.events.clear();
+        if (!file)
+            throw runtime_error("Cannot write trace file");
+    }
+
+    thread_local profile::Scope* innermost = nullptr; ///< scope of this thread allocations are counted in
+
+    atomic<uint64_t> live{0}, peak{0}; ///< bytes of the Storage allocator
+
+    // sites of the Storage allocator, new buffers and reused ones
+    profile::Site allocations("alloc"), reuses("alloc reused");
+
+    // tracing requested by the environment starts with the first use of the registry
+    struct Environment {
+        Environment() {
+            if (getenv("MTRX_TRACE") != nullptr)
+                profile::trace(getenv("MTRX_TRACE"));
+        }
+    } environment;
+}
+
+profile::Site::Site(const char* name) : name(name), calls(0), nanoseconds(0), bytes(0), flops(0) {
+    Registry& r = registry();
+    lock_guard<recursive_mutex> guard(r.lock);
+    r.sites.push_back(this);
+}
+
+void profile::Scope::start(Site* site) {
+    m_site = site;
+    m_outer = innermost;
+    innermost = this;
+    m_start = chrono::steady_clock::now();
+}
+
+void profile::Scope::finish() {
+    innermost = m_outer;
+    auto end = chrono::steady_clock::now();
+    uint64_t elapsed = chrono::duration_cast<chrono::nanoseconds>(end - m_start).count();
+    m_site->calls.fetch_add(1, memory_order_relaxed);
+    m_site->nanoseconds.fetch_add(elapsed, memory_order_relaxed);
+    m_site->flops.fetch_add(m_flops, memory_order_relaxed);
+    Registry& r = registry();
+    if (!r.tracing.load(memory_order_relaxed))
+        return;
+    lock_guard<mutex> guard(r.traceLock);
+    if (m_start >= r.traceStart)
+        r.events.push_back({m_site->name, uint64_t(chrono::duration_cast<chrono::nanoseconds>(m_start - r.traceStart).count()),
+                            elapsed, threadNumber()});
+}
+
+profile::Site* profile::site(const string& name) {
+    if (!enabled())
+        return nullptr;
+    Registry& r = registry();
+    lock_guard<recursive_mutex> guard(r.lock);
+    auto found = r.named.find(name);
+    if (found == r.named.end()) {
+        found = r.named.emplace(name, make_unique<Site>(nullptr)).first;
+        found->second->name = found->first.c_str();
+    }
+    return found->second.get();
+}
+
+void profile::allocated(size_t bytes, bool reused) {
+    uint64_t now = live.fetch_add(bytes, memory_order_relaxed) + bytes;
+    uint64_t highest = peak.load(memory_order_relaxed);
+    while (now > highest && !peak.compare_exchange_weak(highest, now, memory_order_relaxed)) {}
+    if (!enabled())
+        return;
+    Site& site = reused ? reuses : allocations;
+    site.calls.fetch_add(1, memory_order_relaxed);
+    site.bytes.fetch_add(bytes, memory_order_relaxed);
+    for (Scope* s = innermost; s != nullptr; s = s->m_outer)
+        s->m_site->bytes.fetch_add(bytes, memory_order_relaxed);
+}
+
+void profile::released(size_t bytes) {
+    live.fetch_sub(bytes, memory_order_relaxed);
+}
+
+uint64_t profile::liveBytes() {
+    return live.load(memory_order_relaxed);
+}
+
+uint64_t profile::peakBytes() {
+    return peak.load(memory_order_relaxed);
+}
+
+void profile::resetPeak() {
+    peak.store(live.load(memory_order_relaxed), memory_order_relaxed);
+}
+
+void profile::enable(bool on) {
+    active = on;
+}
+
+void profile::reset() {
+    Registry& r = registry();
+    lock_guard<recursive_mutex> guard(r.lock);
+    for (Site* s : r.sites) {
+        s->calls = 0;
+        s->nanoseconds = 0;
+        s->bytes = 0;
+        s->flops = 0;
+    }
+}
+
+void profile::report(ostream& os) {
+    // places doing the same operation in different classes share a name and a line
+    struct Totals {
+        string name;
+        uint64_t calls = 0, nanoseconds = 0, bytes = 0, flops = 0;
+    };
+    map<string, Totals> byName;
+    {
+        Registry& r = registry();
+        lock_guard<recursive_mutex> guard(r.lock);
+        for (Site* s : r.sites)
+            if (s->calls > 0 && s->name != nullptr) {
+                Totals& t = byName[s->name];
+                t.name = s->name;
+                t.calls += s->calls;
+                t.nanoseconds += s->nanoseconds;
+                t.bytes += s->bytes;
+                t.flops += s->flops;
+            }
+    }
+    vector<Totals> sites;
+    for (auto& entry : byName)
+        sites.push_back(entry.second);
+    sort(sites.begin(), sites.end(), [](const Totals& a, const Totals& b) {
+        return a.nanoseconds > b.nanoseconds;
+    });
+    // formatted apart, precision of os is kept for matrices
+    stringstream table;
+    table << left << setw(16) << "site" << right << setw(10) << "calls" << setw(12) << "total ms" << setw(12) << "avg us"
+          << setw(12) << "MB alloc" << setw(12) << "GFLOP" << setw(10) << "GFLOP/s" << "\n";
+    table << fixed;
+    for (const Totals& s : sites) {
+        double ms = s.nanoseconds / 1e6, gflop = s.flops / 1e9;
+        table << left << setw(16) << s.name << right << setw(10) << s.calls << setprecision(3) << setw(12) << ms
+              << setw(12) << ms * 1e3 / s.calls << setw(12) << s.bytes / 1e6 << setw(12) << gflop << setprecision(2)
+              << setw(10) << (s.nanoseconds > 0 ? s.flops / double(s.nanoseconds) : 0.0) << "\n";
+    }
+    if (sites.empty())
+        table << (enabled() ? "nothing recorded yet\n" : "profiling is off\n");
+    os << table.str();
+}
+
+void profile::trace(const string& path) {
+    stopTrace();
+    Registry& r = registry();
+    {
+        lock_guard<mutex> guard(r.traceLock);
+        r.tracePath = path;
+        r.traceStart = chrono::steady_clock::now();
+        r.events.clear();
+    }
+    r.tracing = true;
+    active = true;
+}
+
+void profile::stopTrace() {
+    writeTrace(registry());
+}
@@ -0,0 +1,219 @@
+#include "include/text.hxx"
+#include "include/threadpool.hxx"
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Implementation of text matrix files
+
+namespace {
+    const size_t BLOCK_BYTES = 1 << 20; ///< smallest block of the file handled by one task
+
+    // whitespace inside a line
+    bool blank(char c) {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+    }
+
+    // a written zero such as 0, -0.00 or 0e5, the first pass only estimates the number of non-zeros
+    bool writtenZero(const char* begin, const char* end) {
+        for (const char* p = begin; p < end && *p != 'e' && *p != 'E'; p++)
+            if (*p != '0' && *p != '.' && *p != '-' && *p != '+')
+                return false;
+        return true;
+    }
+
+    // calls element(begin, end) for every element of every non-blank line in [begin, end), and row() after each such line
+    template <typename Element, typename Row>
+    void scan(const char* begin, const char* end, Element element, Row row) {
+        for (const char* p = begin; p < end;) {
+            const char* eol = static_cast<const char*>(memchr(p, '\n', end - p));
+            eol = eol == nullptr ? end : eol;
+            bool any = false;
+            while (p < eol) {
+                while (p < eol && blank(*p))
+                    p++;
+                if (p == eol)
+                    break;
+                const char* token = p;
+                while (p < eol && !blank(*p))
+                    p++;
+                element(token, p);
+                any = true;
+            }
+            if (any)
+                row();
+            p = eol + 1;
+        }
+    }
+
+    double parse(const char* begin, const char* end) {
+        double value = 0;
+        // from_chars does not accept a plus sign
+        const char* p = begin < end && *begin == '+' ? begin + 1 : begin;
+        auto result = from_chars(p, end, value);
+        if (result.ec != errc() || result.ptr != end || p == end)
+            throw runtime_error("Invalid number '" + string(begin, end) + "'");
+        return value;
+    }
+
+    // lines of the file handled by one task
+    struct Block {
+        const char* begin;
+        const char* end;
+        size_t rows = 0;      ///< non-blank lines
+        size_t nonzeros = 0;  ///< elements not written as zero
+        size_t first = 0;     ///< index of the first row of the block in the matrix
+        SparseMatrix::Csr csr; ///< rows of the block if the matrix is sparse
+    };
+
+    // read-only mapping of a whole file
+    struct Mapping {
+        const char* data = nullptr;
+        size_t size = 0;
+        ~Mapping() {
+            if (data != nullptr)
+                munmap(const_cast<char*>(data), size);
+        }
+    };
+
+    void differentSizes() {
+        throw runtime_error("Rows have different sizes");
+    }
+}
+
+double text::Throughput::megabytesPerSecond() const {
+    return seconds > 0 ? bytes / seconds / 1e6 : 0;
+}
+
+shared_ptr<Matrix> text::load(const string& path, Throughput& throughput) {
+    auto start = chrono::steady_clock::now();
+    Mapping file;
+    int fd = open(path.c_str(), O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0) {
+        if (fd >= 0)
+            close(fd);
+        throw runtime_error("Cannot open matrix file");
+    }
+    file.size = info.st_size;
+    if (file.size > 0) {
+        void* mapping = mmap(nullptr, file.size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED) {
+            madvise(mapping, file.size, MADV_SEQUENTIAL);
+            file.data = static_cast<const char*>(mapping);
+        }
+    }
+    close(fd);
+    if (file.size > 0 && file.data == nullptr)
+        throw runtime_error("Cannot map matrix file");
+    const char* end = file.data + file.size;
+
+    // blocks end right after a newline, so no line is split between two tasks
+    ThreadPool& pool = ThreadPool::instance();
+    size_t count = max<size_t>(1, min(file.size / BLOCK_BYTES, pool.size() * 4));
+    vector<Block> blocks(count);
+    const char* begin = file.data;
+    for (size_t b = 0; b < count; b++) {
+        blocks[b].begin = begin;
+        blocks[b].end = end;
+        const char* split = max(begin, file.data + file.size / count * (b + 1));
+        const char* eol = b + 1 == count ? nullptr : static_cast<const char*>(memchr(split, '\n', end - split));
+        if (eol != nullptr)
+            blocks[b].end = eol + 1;
+        begin = blocks[b].end;
+    }
+
+    // the width is taken from the first row, every other row is checked against it
+    size_t width = 0;
+    for (const char* p = file.data; p < end && width == 0;) {
+        const char* eol = static_cast<const char*>(memchr(p, '\n', end - p));
+        eol = eol == nullptr ? end : eol;
+        scan(p, eol, [&](const char*, const char*) {
+            width++;
+        }, []() {});
+        p = eol + 1;
+    }
+    // first pass: rows and non-zeros of every block
+    pool.parallelFor(0, count, 1, [&](size_t lo, size_t hi) {
+        for (size_t b = lo; b < hi; b++)
+            scan(blocks[b].begin, blocks[b].end, [&](const char* token, const char* tokenEnd) {
+                blocks[b].nonzeros += !writtenZero(token, tokenEnd);
+            }, [&]() {
+                blocks[b].rows++;
+            });
+    });
+    size_t rows = 0, nonzeros = 0;
+    for (Block& block : blocks) {
+        block.first = rows;
+        rows += block.rows;
+        nonzeros += block.nonzeros;
+    }
+    throughput.bytes = file.size;
+    shared_ptr<Matrix> result;
+
+    if (rows == 0) {
+        result = make_shared<Matrix>();
+    } else if (nonzeros <= SparseMatrix::maxNonzeros(rows, width)) {
+        // second pass: compressed rows of every block, joined afterwards
+        pool.parallelFor(0, count, 1, [&](size_t lo, size_t hi) {
+            for (size_t b = lo; b < hi; b++) {
+                SparseMatrix::Csr& csr = blocks[b].csr;
+                size_t j = 0;
+                scan(blocks[b].begin, blocks[b].end, [&](const char* token, const char* tokenEnd) {
+                    if (j == width)
+                        differentSizes();
+                    double value = parse(token, tokenEnd);
+                    if (value != 0) {
+                        csr.columns.push_back(j);
+                        csr.values.push_back(value);
+                    }
+                    j++;
+                }, [&]() {
+                    if (j != width)
+                        differentSizes();
+                    csr.offsets.push_back(csr.values.size());
+                    j = 0;
+                });
+            }
+        });
+        SparseMatrix::Csr csr;
+        csr.offsets.push_back(0);
+        for (Block& block : blocks) {
+            size_t base = csr.values.size();
+            for (size_t offset : block.csr.offsets)
+                csr.offsets.push_back(base + offset);
+            csr.columns.insert(csr.columns.end(), block.csr.columns.begin(), block.csr.columns.end());
+            csr.values.insert(csr.values.end(), block.csr.values.begin(), block.csr.values.end());
+            block.csr = SparseMatrix::Csr();
+        }
+        result = SparseMatrix::build(rows, width, move(csr));
+    } else {
+        // second pass: every block parses its rows into their final place
+        Storage data(rows, width);
+        pool.parallelFor(0, count, 1, [&](size_t lo, size_t hi) {
+            for (size_t b = lo; b < hi; b++) {
+                size_t i = blocks[b].first, j = 0;
+                scan(blocks[b].begin, blocks[b].end, [&](const char* token, const char* tokenEnd) {
+                    if (j == width)
+                        differentSizes();
+                    data(i, j++) = parse(token, tokenEnd);
+                }, [&]() {
+                    if (j != width)
+                        differentSizes();
+                    i++;
+                    j = 0;
+                });
+            }
+        });
+        result = Matrix::classify(data);
+    }
+    throughput.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return result;
+}
@@ -0,0 +1,182 @@
+#include "include/threadpool.hxx"
+#include <algorithm>
+#include <cstdlib>
+#include <exception>
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+// Implementation of ThreadPool
+
+namespace {
+    const size_t NOT_A_WORKER = static_cast<size_t>(-1);
+    thread_local size_t t_worker = NOT_A_WORKER; ///< index of the queue owned by this thread
+
+    size_t defaultThreads() {
+        const char* env = getenv("MTRX_THREADS");
+        if (env != nullptr) {
+            try {
+                long threads = stol(env);
+                if (threads > 0)
+                    return min<size_t>(threads, ThreadPool::maxThreads());
+            } catch (exception&) {}
+        }
+        size_t cores = thread::hardware_concurrency();
+        return cores == 0 ? 1 : cores;
+    }
+}
+
+ThreadPool& ThreadPool::instance() {
+    static ThreadPool pool(defaultThreads());
+    return pool;
+}
+
+size_t ThreadPool::maxThreads() {
+    size_t cores = thread::hardware_concurrency();
+    return 4 * (cores == 0 ? 1 : cores);
+}
+
+ThreadPool::ThreadPool(size_t threads) : m_pending(0), m_next(0), m_stop(false) {
+    start(threads - 1);
+}
+
+ThreadPool::~ThreadPool() {
+    stop();
+}
+
+void ThreadPool::resize(size_t threads) {
+    if (threads == 0 || threads > maxThreads())
+        throw invalid_argument("Number of threads must be between 1 and " + to_string(maxThreads()));
+    stop();
+    start(threads - 1);
+}
+
+size_t ThreadPool::size() const {
+    return m_workers.size() + 1;
+}
+
+void ThreadPool::parallelFor(size_t begin, size_t end, size_t grain, const function<void(size_t, size_t)>& body) {
+    if (begin >= end)
+        return;
+    grain = grain == 0 ? 1 : grain;
+    size_t length = end - begin;
+    if (m_workers.empty() || length <= grain) {
+        body(begin, end);
+        return;
+    }
+    // a few chunks per thread so that stealing can even out uneven rows
+    size_t chunks = min((length + grain - 1) / grain, size() * 4);
+    size_t chunk = (length + chunks - 1) / chunks;
+    chunks = (length + chunk - 1) / chunk;
+
+    struct Job {
+        atomic<size_t> remaining;
+        mutex lock;
+        condition_variable done;
+        exception_ptr error;
+    };
+    auto job = make_shared<Job>();
+    job->remaining = chunks;
+    // the first chunk is kept for the calling thread
+    for (size_t c = 1; c < chunks; c++) {
+        size_t lo = begin + c * chunk, hi = min(end, lo + chunk);
+        push([job, &body, lo, hi]() {
+            try {
+                body(lo, hi);
+            } catch (...) {
+                lock_guard<mutex> guard(job->lock);
+                if (!job->error)
+                    job->error = current_exception();
+            }
+            if (--job->remaining == 0) {
+                lock_guard<mutex> guard(job->lock);
+                job->done.notify_all();
+            }
+        });
+    }
+    try {
+        body(begin, min(end, begin + chunk));
+    } catch (...) {
+        lock_guard<mutex> guard(job->lock);
+        if (!job->error)
+            job->error = current_exception();
+    }
+    --job->remaining;
+    while (job->remaining > 0) {
+        if (runOne())
+            continue;
+        unique_lock<mutex> guard(job->lock);
+        job->done.wait(guard, [&job]() { return job->remaining == 0; });
+    }
+    if (job->error)
+        rethrow_exception(job->error);
+}
+
+void ThreadPool::start(size_t workers) {
+    m_stop = false;
+    for (size_t i = 0; i < workers; i++)
+        m_queues.push_back(make_unique<Queue>());
+    for (size_t i = 0; i < workers; i++)
+        m_workers.emplace_back(&ThreadPool::work, this, i);
+}
+
+void ThreadPool::stop() {
+    {
+        lock_guard<mutex> guard(m_sleepLock);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+    for (thread& worker : m_workers)
+        worker.join();
+    m_workers.clear();
+    m_queues.clear();
+}
+
+void ThreadPool::work(size_t index) {
+    t_worker = index;
+    while (true) {
+        if (runOne())
+            continue;
+        unique_lock<mutex> guard(m_sleepLock);
+        m_wake.wait(guard, [this]() { return m_stop || m_pending > 0; });
+        if (m_stop)
+            return;
+    }
+}
+
+void ThreadPool::push(Task task) {
+    size_t index = t_worker != NOT_A_WORKER ? t_worker : m_next++ % m_queues.size();
+    {
+        lock_guard<mutex> guard(m_queues[index]->lock);
+        m_queues[index]->tasks.push_back(move(task));
+    }
+    m_pending++;
+    lock_guard<mutex> guard(m_sleepLock);
+    m_wake.notify_one();
+}
+
+bool ThreadPool::runOne() {
+    Task task;
+    size_t count = m_queues.size();
+    size_t own = t_worker != NOT_A_WORKER ? t_worker : 0;
+    for (size_t i = 0; i < count && !task; i++) {
+        Queue& queue = *m_queues[(own + i) % count];
+        lock_guard<mutex> guard(queue.lock);
+        if (queue.tasks.empty())
+            continue;
+        // own queue is used as a stack, other queues are robbed from the opposite end
+        if (i == 0 && t_worker != NOT_A_WORKER) {
+            task = move(queue.tasks.back());
+            queue.tasks.pop_back();
+        } else {
+            task = move(queue.tasks.front());
+            queue.tasks.pop_front();
+        }
+    }
+    if (!task)
+        return false;
+    m_pending--;
+    task();
+    return true;
+}
@@ -31,3 +31,20 @@ string DiagonalMatrix::whoami() const{
 string IdentityMatrix::whoami() const{
     return "Identity Matrix";
 }
+
+string SparseMatrix::whoami() const{
+    return "Sparse Matrix";
+}
+
+string ViewMatrix::whoami() const{
+    // a view stands for a plain copy, how it is stored is not shown
+    return isSquare() ? "Square Matrix" : "Matrix";
+}
+
+string BlockMatrix::whoami() const{
+    return "Block Matrix";
+}
+
+string FloatMatrix::whoami() const{
+    return "Float Matrix";
+}